@@ -0,0 +1,23 @@
+#version 330 core
+
+// Interpolated values from the vertex shaders
+in vec2 offset;
+in vec3 innerColor;
+in vec3 outerColor;
+
+// output data
+out vec4 color;
+
+void main()
+{
+    float d = length(offset);
+
+    // Fade out over the width of one pixel at the rim
+    float edge = fwidth(d);
+    float coverage = 1.0 - smoothstep(1.0 - edge, 1.0, d);
+    if (coverage <= 0.0)
+        discard;
+
+    // Shade from the centre to the rim like the triangle fan did
+    color = vec4(mix(innerColor, outerColor, min(d, 1.0)), coverage);
+}
@@ -0,0 +1,24 @@
+#version 330 core
+
+// input data : a quad around the circle
+layout (location = 0) in vec3 vertexPosition;
+layout (location = 1) in vec4 centreColor;
+layout (location = 2) in vec4 rimColor;
+layout (location = 3) in vec2 vertexOffset;
+
+uniform mat4 MVP;
+
+// output data : used by fragment shader
+out vec2 offset;
+out vec3 innerColor;
+out vec3 outerColor;
+
+void main ()
+{
+    // Offset from the centre in radii, the rim is at length 1
+    offset = vertexOffset;
+    innerColor = centreColor.rgb;
+    outerColor = rimColor.rgb;
+
+    gl_Position = MVP * vec4(vertexPosition, 1);
+}
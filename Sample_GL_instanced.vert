@@ -0,0 +1,20 @@
+#version 330 core
+
+// input data : one shared mesh, with an offset and a color per instance
+layout (location = 0) in vec3 vertexPosition;
+layout (location = 2) in vec2 instanceOffset;
+layout (location = 3) in vec3 instanceColor;
+
+uniform mat4 VP;
+
+// output data : used by fragment shader
+out vec3 fragColor;
+
+void main ()
+{
+    // Every vertex of an instance takes the instance color
+    fragColor = instanceColor;
+
+    // Move the mesh to the instance, then into clip space
+    gl_Position = VP * vec4(vertexPosition.xy + instanceOffset, vertexPosition.z, 1);
+}
@@ -0,0 +1,15 @@
+#version 330 core
+
+// Interpolated values from the vertex shaders
+in vec2 UV;
+
+uniform sampler2D layer;
+
+// output data
+out vec3 color;
+
+void main()
+{
+    // Copy the cached layer through unchanged
+    color = texture(layer, UV).rgb;
+}
@@ -0,0 +1,15 @@
+#version 330 core
+
+// input data : a quad already in clip space
+layout (location = 0) in vec3 vertexPosition;
+
+// output data : used by fragment shader
+out vec2 UV;
+
+void main ()
+{
+    // Clip space runs -1..1, texture coordinates 0..1
+    UV = vertexPosition.xy * 0.5 + 0.5;
+
+    gl_Position = vec4(vertexPosition, 1);
+}
@@ -3,37 +3,86 @@
 #include <fstream>
 #include <vector>
 #include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <cstddef>
+#ifndef HEADLESS
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
+#endif
 
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
 #define GRAV_CONST 0.009
 #define MAX_POWER 2.2
 #define VEL_THRE 0.02
+#define BIRD_SPEED_CAP 0.3	// per tick and component; swept tests stop faster birds tunnelling
+#define MAX_BIRD 20
+#define BIRD_RADIUS 0.2
+#define MAX_SHOTS 15
 #define MAX_ENEMY 10
 #define MAX_WOOD 500
+#define MAX_BODIES (MAX_BIRD + MAX_ENEMY + MAX_WOOD)
+#define GRID_BUCKETS 4096
+#define SLEEP_TICKS 30
+#define TUNED_WALLS 2	// Floor and CWall, see World::hitWalls()
+#define SUBSTEP_SPEED BIRD_RADIUS	// island speed per tick past which its contacts get unreliable
+#define SUBSTEP_CONTACTS 4	// contacts in an island this tick that make it a pile-up
+#define MAX_SUBSTEPS 4
+#define OBS_SIZE (3 + 3*MAX_BODIES)
 
 int ENEMY_NUMBER = 6;
 int WOOD_NUMBER = 308;
-int enemies_left = ENEMY_NUMBER;
+bool adaptive_substeps = true;
 
 using namespace std;
 
+#ifndef HEADLESS
+// Interleaved vertex, 16 bytes: position then RGBA8 color
+struct Vertex {
+	GLfloat x, y, z;
+	GLubyte r, g, b, a;
+};
+
+// A program other than programID that sprites can be drawn with
+struct Shader {
+	GLuint ProgramID;
+	GLint MatrixID;	// its "MVP" uniform
+	bool blend;	// alpha is coverage, so draw with blending on
+};
+
 struct VAO {
 	GLuint VertexArrayID;
-	GLuint VertexBuffer;
-	GLuint ColorBuffer;
+	GLuint VertexBuffer;	// Vertex array, position and color interleaved
 
 	GLenum PrimitiveMode;
 	GLenum FillMode;
 	int NumVertices;
+	Shader *shader;	// NULL draws with programID
+	VAO *coarser;	// same mesh in less detail, NULL if none
 };
+#else
+struct VAO;	// Headless builds never create sprites
+#endif
 typedef struct VAO VAO;
 
+#ifndef HEADLESS
 struct GLMatrices {
 	glm::mat4 projection;
 	glm::mat4 model;
@@ -42,6 +91,7 @@ struct GLMatrices {
 } Matrices;
 
 GLuint programID;
+#endif
 
 //####################################################################################################
 vector<int> sevensegdecoder[10];
@@ -56,7 +106,7 @@ struct Player {
 	int score;
 	float wind;
 	bool game_over;
-} Player1;
+};
 
 class Character {
 public:
@@ -69,20 +119,23 @@ public:
 	float elast_const;
 	float rest_const;
 	float air_const;
+	float px, py;	// position at the previous tick, for render interpolation
+
+	bool sleeping;
+	int still;	// ticks spent under VEL_THRE
+	int island;	// island the body fell asleep with
 
 	bool alive;
 
 	VAO *sprite;
-} Wood[MAX_WOOD], Enemies[MAX_ENEMY], Bird[20];
-
-int bird_count = 0;
+};
 
 class Wall {
 public:
 	float x, y;
 	float size_x, size_y;
 	VAO *sprite;
-} Floor, CWall;
+};
 
 class Bar {
 public:
@@ -99,13 +152,214 @@ public:
 	float power;
 	VAO *base;
 	VAO *barrel;
-} Cannon;
+};
+
+enum material {MAT_BIRD=0, MAT_ENEMY=1, MAT_WOOD=2, MAT_COUNT=3};
+
+struct Material {
+	float fric_const;
+	float elast_const;
+	float rest_const;
+	float air_const;
+} Materials[MAT_COUNT] = {
+	{0.96, 0, 0.7, 0.999},	// Bird
+	{0.96, 0, 0.7, 0.95},	// Enemy
+	{0.96, 0, 0.7, 0.95},	// Wood
+};
+
+void setMaterial(Character& C, int mat) {
+	C.fric_const = Materials[mat].fric_const;
+	C.elast_const = Materials[mat].elast_const;
+	C.rest_const = Materials[mat].rest_const;
+	C.air_const = Materials[mat].air_const;
+}
+
+#define BIRD_BASE 0
+#define ENEMY_BASE MAX_BIRD
+#define WOOD_BASE (MAX_BIRD + MAX_ENEMY)
+
+// BODY_DOOMED marks a kill waiting in the EventQueue. It is only set
+// between collide() and resolveEvents(), when nothing is gathered over it
+enum body_flags {BODY_ALIVE=1, BODY_DOOMED=2};
+
+/**
+   Structure-of-arrays copy of every body. Groups sit at fixed offsets,
+   [birds | enemies | wood], so a body keeps the same index every tick.
+   gather() and scatter() copy state to and from the Character arrays,
+   which lets the collision functions keep working on Characters while
+   the bulk stages walk contiguous arrays.
+*/
+class BodyStore {
+public:
+	float x[MAX_BODIES], y[MAX_BODIES];
+	float vx[MAX_BODIES], vy[MAX_BODIES];
+	float radius[MAX_BODIES];
+	unsigned char flags[MAX_BODIES];
+	unsigned char material[MAX_BODIES];
+
+	void gather(Character *C, int first, int n, int mat) {
+		for (int i=0; i<n; i++) {
+			x[first+i] = C[i].x;
+			y[first+i] = C[i].y;
+			vx[first+i] = C[i].Vel[0];
+			vy[first+i] = C[i].Vel[1];
+			radius[first+i] = C[i].radius;
+			flags[first+i] = C[i].alive ? BODY_ALIVE : 0;
+			material[first+i] = mat;
+		}
+	}
+
+	void scatter(Character *C, int first, int n) {
+		for (int i=0; i<n; i++) {
+			C[i].x = x[first+i];
+			C[i].y = y[first+i];
+			C[i].Vel = glm::vec2(vx[first+i], vy[first+i]);
+			C[i].alive = flags[first+i] & BODY_ALIVE;
+		}
+	}
+};
+
+/**
+   Bulk kernels over packed body arrays. Each has a scalar version and,
+   on x86, SSE2 and AVX2 versions built with per-function target
+   attributes. selectKernels() picks the widest one the CPU supports at
+   startup, so the binary itself needs no -m flags.
+*/
+struct Kernels {
+	const char *name;
+	void (*gravity)(float *vy, int n, double g);
+	void (*clamp)(float *vx, float *vy, int n, float cap);
+	void (*integrate)(float *x, float *y, const float *vx, const float *vy, int n);
+};
+
+// Gravity is subtracted in double, as Vel[1] -= GRAV_CONST always was
+void gravityScalar(float *vy, int n, double g) {
+	for (int i=0; i<n; i++)
+		vy[i] -= g;
+}
+
+void clampScalar(float *vx, float *vy, int n, float cap) {
+	for (int i=0; i<n; i++) {
+		vx[i] = vx[i]>cap? cap:vx[i];
+		vy[i] = vy[i]>cap? cap:vy[i];
+	}
+}
+
+void integrateScalar(float *x, float *y, const float *vx, const float *vy, int n) {
+	for (int i=0; i<n; i++) {
+		x[i] += vx[i];
+		y[i] += vy[i];
+	}
+}
+
+Kernels ScalarKernels = {"scalar", gravityScalar, clampScalar, integrateScalar};
+
+#ifdef HAVE_X86_SIMD
+/* The vector loops leave the tail to the scalar versions */
+
+__attribute__((target("sse2")))
+void gravitySSE2(float *vy, int n, double g) {
+	__m128d G = _mm_set1_pd(g);
+	int i = 0;
+	for (; i+4<=n; i+=4) {
+		__m128 v = _mm_loadu_ps(vy+i);
+		__m128d lo = _mm_sub_pd(_mm_cvtps_pd(v), G);
+		__m128d hi = _mm_sub_pd(_mm_cvtps_pd(_mm_movehl_ps(v, v)), G);
+		_mm_storeu_ps(vy+i, _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi)));
+	}
+	gravityScalar(vy+i, n-i, g);
+}
+
+__attribute__((target("sse2")))
+void clampSSE2(float *vx, float *vy, int n, float cap) {
+	__m128 C = _mm_set1_ps(cap);
+	int i = 0;
+	for (; i+4<=n; i+=4) {
+		_mm_storeu_ps(vx+i, _mm_min_ps(_mm_loadu_ps(vx+i), C));
+		_mm_storeu_ps(vy+i, _mm_min_ps(_mm_loadu_ps(vy+i), C));
+	}
+	clampScalar(vx+i, vy+i, n-i, cap);
+}
+
+__attribute__((target("sse2")))
+void integrateSSE2(float *x, float *y, const float *vx, const float *vy, int n) {
+	int i = 0;
+	for (; i+4<=n; i+=4) {
+		_mm_storeu_ps(x+i, _mm_add_ps(_mm_loadu_ps(x+i), _mm_loadu_ps(vx+i)));
+		_mm_storeu_ps(y+i, _mm_add_ps(_mm_loadu_ps(y+i), _mm_loadu_ps(vy+i)));
+	}
+	integrateScalar(x+i, y+i, vx+i, vy+i, n-i);
+}
+
+__attribute__((target("avx2")))
+void gravityAVX2(float *vy, int n, double g) {
+	__m256d G = _mm256_set1_pd(g);
+	int i = 0;
+	for (; i+8<=n; i+=8) {
+		__m256 v = _mm256_loadu_ps(vy+i);
+		__m256d lo = _mm256_sub_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(v)), G);
+		__m256d hi = _mm256_sub_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)), G);
+		_mm256_storeu_ps(vy+i, _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(lo)), _mm256_cvtpd_ps(hi), 1));
+	}
+	gravityScalar(vy+i, n-i, g);
+}
+
+__attribute__((target("avx2")))
+void clampAVX2(float *vx, float *vy, int n, float cap) {
+	__m256 C = _mm256_set1_ps(cap);
+	int i = 0;
+	for (; i+8<=n; i+=8) {
+		_mm256_storeu_ps(vx+i, _mm256_min_ps(_mm256_loadu_ps(vx+i), C));
+		_mm256_storeu_ps(vy+i, _mm256_min_ps(_mm256_loadu_ps(vy+i), C));
+	}
+	clampScalar(vx+i, vy+i, n-i, cap);
+}
+
+__attribute__((target("avx2")))
+void integrateAVX2(float *x, float *y, const float *vx, const float *vy, int n) {
+	int i = 0;
+	for (; i+8<=n; i+=8) {
+		_mm256_storeu_ps(x+i, _mm256_add_ps(_mm256_loadu_ps(x+i), _mm256_loadu_ps(vx+i)));
+		_mm256_storeu_ps(y+i, _mm256_add_ps(_mm256_loadu_ps(y+i), _mm256_loadu_ps(vy+i)));
+	}
+	integrateScalar(x+i, y+i, vx+i, vy+i, n-i);
+}
+
+Kernels SSE2Kernels = {"sse2", gravitySSE2, clampSSE2, integrateSSE2};
+Kernels AVX2Kernels = {"avx2", gravityAVX2, clampAVX2, integrateAVX2};
+#endif
+
+Kernels Simd = ScalarKernels;
+
+void selectKernels() {
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		Simd = AVX2Kernels;
+	else if (__builtin_cpu_supports("sse2"))
+		Simd = SSE2Kernels;
+#endif
+}
+
+void applyGravity(BodyStore& B, int first, int n, double g) {
+	Simd.gravity(B.vy+first, n, g);
+}
+
+// Caps each velocity component from above, as birds are capped
+void clampVelocity(BodyStore& B, int first, int n, float cap) {
+	Simd.clamp(B.vx+first, B.vy+first, n, cap);
+}
+
+// Explicit Euler step, velocities are per tick
+void integrate(BodyStore& B, int first, int n) {
+	Simd.integrate(B.x+first, B.y+first, B.vx+first, B.vy+first, n);
+}
 
 float clamp(float value, float min, float max) {
 	return std::max(min, std::min(max, value));
 }
 
-bool MoveFixedColl(Wall& W, Character& C)
+bool FixedColl(Wall& W, Character& C)
 {
 	glm::vec2 center(C.x, C.y);
 	glm::vec2 aabb_half_extents(W.size_x, W.size_y);
@@ -162,10 +416,16 @@ bool MoveFixedColl(Wall& W, Character& C)
 		}
 		return true;
 	}
-	else {
-		C.Vel *= C.air_const;
-		return false;
-	}
+	return false;
+}
+
+// FixedColl, charging the air drag when the body misses the wall
+bool MoveFixedColl(Wall& W, Character& C)
+{
+	if (FixedColl(W, C))
+		return true;
+	C.Vel *= C.air_const;
+	return false;
 }
 
 /**
@@ -173,6 +433,8 @@ bool MoveFixedColl(Wall& W, Character& C)
    killB = 1, kill B
    killB = 2, Dunno
    killB = 3, A acts like fixed
+   Only velocities and positions of A and B change here, kills are
+   posted as events by the caller.
 */
 bool MovMovColl(Character& A, Character& B, int killB)
 {
@@ -212,329 +474,2878 @@ bool MovMovColl(Character& A, Character& B, int killB)
 			A.Vel[0] = 0;
 		if(abs(B.Vel[1]) < VEL_THRE)
 			A.Vel[1] = 0;
-		if(killB && killB != 3) {
-			B.alive = 0;
-			Player1.score += 10;
-		}
 		return true;
 	}
 	return false;
 }
 
-void gravity() {
+/**
+   Swept tests for continuous collision. Each returns the fraction of a
+   tick's move d at which a circle at p of radius r first touches the
+   other shape, or 1 if it never does. A circle within SWEEP_SKIN of
+   touching at the start, or ending the move less than depth deep in the
+   other shape, also gets 1: the discrete tests handle those contacts as
+   before, so only a move that would skip through the shape or sink into
+   it is cut short. Without the skin, a body held a rounding error short
+   of a contact would get t = 0 again every tick and never move.
+*/
+#define SWEEP_SKIN 0.001
 
-	for (int j=0; j<bird_count; j++)
-		Bird[j].Vel[1] -= GRAV_CONST;
-	for (int i=0; i<ENEMY_NUMBER; i++)
-		Enemies[i].Vel[1] -= GRAV_CONST;
+float sweepCircle(glm::vec2 p, glm::vec2 d, float r, float depth)
+{
+	float a = glm::dot(d, d);
+	float b = 2*glm::dot(p, d);
+	float c = glm::dot(p, p) - r*r;
+	float end = glm::length(p + d);
+	if (glm::length(p) <= r + SWEEP_SKIN || a == 0 || (end <= r && end > r - depth))
+		return 1;
+	float disc = b*b - 4*a*c;
+	if (disc < 0)
+		return 1;
+	float t = (-b - sqrt(disc))/(2*a);
+	return t >= 0 && t < 1 ? t : 1;
+}
 
-	// Bird, Enemy
-	for (int i=0; i<ENEMY_NUMBER; i++)
-		for (int j=0; j<bird_count; j++)
-			if(MovMovColl(Bird[j], Enemies[i], 1))
-				enemies_left--;
+// The box grown by r is tested slab by slab, its rounded corners as circles
+float sweepBox(glm::vec2 p, glm::vec2 d, float r, float depth, const Wall& W)
+{
+	glm::vec2 half(W.size_x, W.size_y);
+	glm::vec2 o = p - glm::vec2(W.x, W.y);
+	if (glm::length(o - glm::clamp(o, -half, half)) <= r + SWEEP_SKIN)
+		return 1;
+	float end = glm::length(o + d - glm::clamp(o + d, -half, half));
+	if (end <= r && end > r - depth)
+		return 1;
+
+	float enter = 0, leave = 1;
+	for (int k=0; k<2; k++) {
+		float h = half[k] + r;
+		if (d[k] == 0) {
+			if (fabs(o[k]) > h)
+				return 1;
+			continue;
+		}
+		float t1 = (-h - o[k])/d[k], t2 = (h - o[k])/d[k];
+		enter = max(enter, min(t1, t2));
+		leave = min(leave, max(t1, t2));
+		if (enter > leave)
+			return 1;
+	}
 
-	// Enemy, Enemy
-	for (int i=0; i<ENEMY_NUMBER; i++)
-		for(int j=i+1; j<ENEMY_NUMBER; j++)
-			MovMovColl(Enemies[i], Enemies[j], 0);
+	glm::vec2 hit = o + d*enter;
+	if (fabs(hit.x) > half.x && fabs(hit.y) > half.y) {
+		glm::vec2 corner(hit.x > 0 ? half.x : -half.x, hit.y > 0 ? half.y : -half.y);
+		return sweepCircle(o - corner, d, r, depth);
+	}
+	return enter;
+}
 
-	// Wood Bird
-	for (int i=0; i<WOOD_NUMBER; i++)
-		for (int j=0; j<bird_count; j++) {
-			if (Wood[i].alive)
-				MovMovColl(Bird[j], Wood[i], 2);
-			if (!Wood[i].alive)
-				Wood[i].Vel[1] -= GRAV_CONST*0.1;
-		}
+/**
+   Dynamic AABB tree over the level's walls. Leaves hold a wall id and
+   its box grown by WALL_MARGIN, so a kinematic wall can creep without
+   touching the tree; only when it leaves its grown box is it taken out
+   and put back in. A new leaf goes next to the node whose box it grows
+   the least, which keeps walls near each other near each other in the
+   tree, and a query only descends into boxes it overlaps.
+*/
+#define WALL_MARGIN 0.1
 
-	//Enemy Wood
-	for (int i=0; i<ENEMY_NUMBER; i++)
-		for(int j=0; j<WOOD_NUMBER; j++)
-			if (Wood[j].alive)
-				MovMovColl(Wood[j], Enemies[i], 3);
+class WallTree {
+public:
+	struct Node {
+		glm::vec2 lo, hi;
+		int parent, left, right;	// left < 0 at a leaf
+		int wall;
+	};
+	vector<Node> nodes;
+	vector<int> free_nodes, stack;
+	int root;
 
-	// Bird Floor
-	for (int j=0; j<bird_count; j++)
-		MoveFixedColl(Floor, Bird[j]);
+	WallTree() : root(-1) {}
 
-	// Bird Wall
-	for (int j=0; j<bird_count; j++)
-		MoveFixedColl(CWall, Bird[j]);
+	static float perimeter(glm::vec2 lo, glm::vec2 hi) {
+		return (hi.x - lo.x) + (hi.y - lo.y);
+	}
 
-	// Enemy Wall
-	for (int i=0; i<ENEMY_NUMBER; i++)
-		MoveFixedColl(CWall, Enemies[i]);
+	int allocate() {
+		if (free_nodes.empty()) {
+			nodes.push_back(Node());
+			return (int)nodes.size()-1;
+		}
+		int n = free_nodes.back();
+		free_nodes.pop_back();
+		return n;
+	}
 
-	// Enemy Floor
-	for (int i=0; i<ENEMY_NUMBER; i++)
-		MoveFixedColl(Floor, Enemies[i]);
+	// Grows every box from n up to the root around its children again
+	void refitUp(int n) {
+		for (; n >= 0; n = nodes[n].parent) {
+			Node& N = nodes[n];
+			N.lo = glm::min(nodes[N.left].lo, nodes[N.right].lo);
+			N.hi = glm::max(nodes[N.left].hi, nodes[N.right].hi);
+		}
+	}
+
+	// Returns the leaf, which moveWall() and removeWall() need later
+	int insert(int wall, glm::vec2 lo, glm::vec2 hi) {
+		int leaf = allocate();
+		Node& L = nodes[leaf];
+		L.lo = lo - glm::vec2(WALL_MARGIN);
+		L.hi = hi + glm::vec2(WALL_MARGIN);
+		L.parent = L.left = L.right = -1;
+		L.wall = wall;
+		if (root < 0) {
+			root = leaf;
+			return leaf;
+		}
+
+		int sibling = root;
+		while (nodes[sibling].left >= 0) {
+			int a = nodes[sibling].left, b = nodes[sibling].right;
+			float grow_a = perimeter(glm::min(nodes[a].lo, L.lo), glm::max(nodes[a].hi, L.hi)) - perimeter(nodes[a].lo, nodes[a].hi);
+			float grow_b = perimeter(glm::min(nodes[b].lo, L.lo), glm::max(nodes[b].hi, L.hi)) - perimeter(nodes[b].lo, nodes[b].hi);
+			sibling = grow_a <= grow_b ? a : b;
+		}
 
-	for (int j=0; j<bird_count; j++) {
-		Bird[j].Vel[0] = Bird[j].Vel[0]>0.3? 0.3:Bird[j].Vel[0];
-		Bird[j].Vel[1] = Bird[j].Vel[1]>0.3? 0.3:Bird[j].Vel[1];
+		int up = nodes[sibling].parent, joint = allocate();
+		Node& J = nodes[joint];
+		J.parent = up;
+		J.left = sibling;
+		J.right = leaf;
+		J.wall = -1;
+		nodes[sibling].parent = joint;
+		nodes[leaf].parent = joint;
+		if (up < 0)
+			root = joint;
+		else if (nodes[up].left == sibling)
+			nodes[up].left = joint;
+		else
+			nodes[up].right = joint;
+		refitUp(joint);
+		return leaf;
+	}
 
-		Bird[j].x += Bird[j].Vel[0];
-		Bird[j].y += Bird[j].Vel[1];
+	void remove(int leaf) {
+		free_nodes.push_back(leaf);
+		int joint = nodes[leaf].parent;
+		if (joint < 0) {
+			root = -1;
+			return;
+		}
+		int sibling = nodes[joint].left == leaf ? nodes[joint].right : nodes[joint].left;
+		int up = nodes[joint].parent;
+		free_nodes.push_back(joint);
+		nodes[sibling].parent = up;
+		if (up < 0) {
+			root = sibling;
+			return;
+		}
+		if (nodes[up].left == joint)
+			nodes[up].left = sibling;
+		else
+			nodes[up].right = sibling;
+		refitUp(up);
 	}
 
-	for (int i=0; i<ENEMY_NUMBER; i++) {
-		Enemies[i].x += Enemies[i].Vel[0];
-		Enemies[i].y += Enemies[i].Vel[1];
+	// Moves a leaf to a wall's new box, returning the leaf it is now at
+	int refit(int leaf, glm::vec2 lo, glm::vec2 hi) {
+		Node& L = nodes[leaf];
+		if (lo.x >= L.lo.x && lo.y >= L.lo.y && hi.x <= L.hi.x && hi.y <= L.hi.y)
+			return leaf;
+		int wall = L.wall;
+		remove(leaf);
+		return insert(wall, lo, hi);
 	}
-	for (int i=0; i<WOOD_NUMBER; i++) {
-		Wood[i].x += Wood[i].Vel[0];
-		Wood[i].y += Wood[i].Vel[1];
+
+	// Appends the walls whose boxes overlap [lo, hi] to out, in ascending id order
+	void query(glm::vec2 lo, glm::vec2 hi, vector<int>& out) {
+		if (root < 0)
+			return;
+		size_t first = out.size();
+		stack.clear();
+		stack.push_back(root);
+		while (!stack.empty()) {
+			Node& N = nodes[stack.back()];
+			stack.pop_back();
+			if (N.lo.x > hi.x || N.lo.y > hi.y || lo.x > N.hi.x || lo.y > N.hi.y)
+				continue;
+			if (N.left < 0)
+				out.push_back(N.wall);
+			else {
+				stack.push_back(N.left);
+				stack.push_back(N.right);
+			}
+		}
+		sort(out.begin()+first, out.end());
 	}
-}
+};
 
-//####################################################################################################
+/**
+   Uniform grid broadphase. Body centers are bucketed by cell, and a
+   query only returns bodies from the 3x3 block of cells around a point.
+   With cells at least as wide as the largest radius sum, every
+   overlapping pair is found this way.
+*/
+class Grid {
+public:
+	float cell;
+	vector<int> start;	// start[b]..start[b+1] is bucket b in entries
+	vector<int> entries;	// body indices grouped by bucket, ascending
+	vector<int> bucket;	// bucket of each inserted body
+	vector<int> cx, cy;	// cell of each body
+
+	int cellOf(float v) {
+		return (int)floor(v/cell);
+	}
 
-/* Function to load Shaders - Use it as it is */
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path) {
+	int hash(int x, int y) {
+		return (int)(((unsigned)x*73856093u ^ (unsigned)y*19349663u) & (GRID_BUCKETS-1));
+	}
 
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+	// Inserts the bodies listed in ids, n bounds the body indices
+	void build(Character *C, int n, const vector<int>& ids, float cell_size) {
+		cell = cell_size;
+		start.assign(GRID_BUCKETS+1, 0);
+		bucket.resize(n);
+		cx.resize(n);
+		cy.resize(n);
+		for (size_t k=0; k<ids.size(); k++) {
+			int i = ids[k];
+			cx[i] = cellOf(C[i].x);
+			cy[i] = cellOf(C[i].y);
+			bucket[i] = hash(cx[i], cy[i]);
+			start[bucket[i]+1]++;
+		}
+		for (int b=0; b<GRID_BUCKETS; b++)
+			start[b+1] += start[b];
 
-	// Read the Vertex Shader code from the file
-	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-	if(VertexShaderStream.is_open())
-	{
-		std::string Line = "";
-		while(getline(VertexShaderStream, Line))
-			VertexShaderCode += "\n" + Line;
-		VertexShaderStream.close();
+		vector<int> fill(start.begin(), start.end()-1);
+		entries.resize(start[GRID_BUCKETS]);
+		for (size_t k=0; k<ids.size(); k++)
+			entries[fill[bucket[ids[k]]]++] = ids[k];
 	}
 
-	// Read the Fragment Shader code from the file
-	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if(FragmentShaderStream.is_open()){
-		std::string Line = "";
-		while(getline(FragmentShaderStream, Line))
-			FragmentShaderCode += "\n" + Line;
-		FragmentShaderStream.close();
+	// Appends bodies in the cells over [x0, x1] x [y0, y1] and one cell around them
+	void queryBox(float x0, float y0, float x1, float y1, vector<int>& out) {
+		for (int qx=cellOf(x0)-1; qx<=cellOf(x1)+1; qx++)
+			for (int qy=cellOf(y0)-1; qy<=cellOf(y1)+1; qy++) {
+				int b = hash(qx, qy);
+				for (int k=start[b]; k<start[b+1]; k++) {
+					int i = entries[k];
+					if (cx[i] == qx && cy[i] == qy)
+						out.push_back(i);
+				}
+			}
 	}
 
-	GLint Result = GL_FALSE;
-	int InfoLogLength;
+	// Appends bodies near (x, y) to out in ascending index order
+	void query(float x, float y, vector<int>& out) {
+		int qx = cellOf(x), qy = cellOf(y);
+		size_t first = out.size();
+		for (int dx=-1; dx<=1; dx++)
+			for (int dy=-1; dy<=1; dy++) {
+				int b = hash(qx+dx, qy+dy);
+				for (int k=start[b]; k<start[b+1]; k++) {
+					int i = entries[k];
+					if (cx[i] == qx+dx && cy[i] == qy+dy)
+						out.push_back(i);
+				}
+			}
+		sort(out.begin()+first, out.end());
+	}
+};
 
-	// Compile Vertex Shader
-	printf("Compiling shader : %s\n", vertex_file_path);
-	char const * VertexSourcePointer = VertexShaderCode.c_str();
-	glShaderSource(VertexShaderID, 1, &VertexSourcePointer , NULL);
-	glCompileShader(VertexShaderID);
+enum broadphase_kind {BROAD_GRID, BROAD_SAP};
+broadphase_kind broadphase = BROAD_GRID;
 
-	// Check Vertex Shader
-	glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	std::vector<char> VertexShaderErrorMessage(InfoLogLength);
-	glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
-	fprintf(stdout, "%s\n", &VertexShaderErrorMessage[0]);
+/**
+   Sweep and prune along x for the Bird x Wood and Enemy x Wood pairs.
+   Every body is a [lo, hi] interval in one list of endpoints that is
+   kept between ticks and re-sorted by insertion, so a tick where little
+   moved costs little more than a pass over the list. Bodies are keyed
+   by id (BIRD_BASE, ENEMY_BASE, WOOD_BASE) and a pair is reported when
+   the boxes overlap on y as well. Wood is only paired with birds and
+   enemies, so the wood and the movers are kept in separate open lists.
+*/
+class SweepAndPrune {
+public:
+	struct Endpoint {
+		float value;
+		int end;	// body id*2, plus one at the upper end
+	};
+	vector<Endpoint> axis;
+	vector<float> lo_x, hi_x, lo_y, hi_y;
+	vector<char> live;
+	vector<int> open_wood, open_movers;
+	int birds, enemies, wood;	// bodies the list was made for
 
-	// Compile Fragment Shader
-	printf("Compiling shader : %s\n", fragment_file_path);
-	char const * FragmentSourcePointer = FragmentShaderCode.c_str();
-	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , NULL);
-	glCompileShader(FragmentShaderID);
+	SweepAndPrune() : birds(-1), enemies(-1), wood(-1) {}
 
-	// Check Fragment Shader
-	glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	std::vector<char> FragmentShaderErrorMessage(InfoLogLength);
-	glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
-	fprintf(stdout, "%s\n", &FragmentShaderErrorMessage[0]);
+	// Remakes the list when bodies were added or removed
+	void track(int bird_count, int enemy_count, int wood_count) {
+		if (bird_count == birds && enemy_count == enemies && wood_count == wood)
+			return;
+		birds = bird_count;
+		enemies = enemy_count;
+		wood = wood_count;
+		axis.clear();
+		for (int i=0; i<birds; i++)
+			add(BIRD_BASE+i);
+		for (int i=0; i<enemies; i++)
+			add(ENEMY_BASE+i);
+		for (int i=0; i<wood; i++)
+			add(WOOD_BASE+i);
+		lo_x.assign(MAX_BODIES, 0);
+		hi_x.assign(MAX_BODIES, 0);
+		lo_y.assign(MAX_BODIES, 0);
+		hi_y.assign(MAX_BODIES, 0);
+		live.assign(MAX_BODIES, 0);
+	}
 
-	// Link the program
-	fprintf(stdout, "Linking program\n");
-	GLuint ProgramID = glCreateProgram();
-	glAttachShader(ProgramID, VertexShaderID);
-	glAttachShader(ProgramID, FragmentShaderID);
-	glLinkProgram(ProgramID);
+	void add(int id) {
+		Endpoint lo = {0, 2*id}, hi = {0, 2*id+1};
+		axis.push_back(lo);
+		axis.push_back(hi);
+	}
 
-	// Check the program
-	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
-	glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	std::vector<char> ProgramErrorMessage( max(InfoLogLength, int(1)) );
-	glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
-	fprintf(stdout, "%s\n", &ProgramErrorMessage[0]);
+	void bounds(int id, const Character& C, float half, bool alive) {
+		lo_x[id] = C.x - half;
+		hi_x[id] = C.x + half;
+		lo_y[id] = C.y - half;
+		hi_y[id] = C.y + half;
+		live[id] = alive;
+	}
 
-	glDeleteShader(VertexShaderID);
-	glDeleteShader(FragmentShaderID);
+	// Lower ends go first on a tie so that touching boxes still meet
+	static bool before(const Endpoint& a, const Endpoint& b) {
+		return a.value < b.value || (a.value == b.value && (a.end & 1) < (b.end & 1));
+	}
 
-	return ProgramID;
-}
+	void sortAxis() {
+		for (size_t k=0; k<axis.size(); k++) {
+			int id = axis[k].end >> 1;
+			axis[k].value = axis[k].end & 1 ? hi_x[id] : lo_x[id];
+		}
+		for (size_t k=1; k<axis.size(); k++) {
+			Endpoint e = axis[k];
+			size_t j = k;
+			for (; j > 0 && before(e, axis[j-1]); j--)
+				axis[j] = axis[j-1];
+			axis[j] = e;
+		}
+	}
 
-static void error_callback(int error, const char* description)
-{
-	fprintf(stderr, "Error: %s\n", description);
-}
+	static void close(vector<int>& open, int id) {
+		for (size_t k=0; k<open.size(); k++)
+			if (open[k] == id) {
+				open[k] = open.back();
+				open.pop_back();
+				return;
+			}
+	}
 
-void quit(GLFWwindow *window)
-{
-	glfwDestroyWindow(window);
-	glfwTerminate();
-	exit(EXIT_SUCCESS);
-}
+	// Pairs in the order detectWood() gives them: (wood, bird) and (enemy, wood)
+	void report(int mover, int w, vector< pair<int, int> >& birdPairs, vector< pair<int, int> >& enemyPairs) {
+		if (lo_y[mover] > hi_y[w] || lo_y[w] > hi_y[mover])
+			return;
+		if (mover < ENEMY_BASE)
+			birdPairs.push_back(make_pair(w-WOOD_BASE, mover-BIRD_BASE));
+		else
+			enemyPairs.push_back(make_pair(mover-ENEMY_BASE, w-WOOD_BASE));
+	}
 
-/* Generate VAO, VBOs and return VAO handle */
-struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL)
-{
-	struct VAO* vao = new struct VAO;
-	vao->PrimitiveMode = primitive_mode;
-	vao->NumVertices = numVertices;
-	vao->FillMode = fill_mode;
+	void find(vector< pair<int, int> >& birdPairs, vector< pair<int, int> >& enemyPairs) {
+		sortAxis();
+		open_wood.clear();
+		open_movers.clear();
+		for (size_t k=0; k<axis.size(); k++) {
+			int id = axis[k].end >> 1;
+			bool is_wood = id >= WOOD_BASE;
+			if (!live[id])
+				continue;
+			if (axis[k].end & 1) {
+				close(is_wood ? open_wood : open_movers, id);
+				continue;
+			}
+			if (is_wood) {
+				for (size_t m=0; m<open_movers.size(); m++)
+					report(open_movers[m], id, birdPairs, enemyPairs);
+				open_wood.push_back(id);
+			}
+			else {
+				for (size_t m=0; m<open_wood.size(); m++)
+					report(id, open_wood[m], birdPairs, enemyPairs);
+				open_movers.push_back(id);
+			}
+		}
+	}
+};
+
+float maxRadius(Character *C, int n) {
+	float r = 0;
+	for (int i=0; i<n; i++)
+		r = max(r, C[i].radius);
+	return r;
+}
+
+/**
+   Sleep state. A body that stays under VEL_THRE for SLEEP_TICKS ticks is
+   put to sleep together with everything it touched, its island, once
+   the whole island has settled. Sleeping bodies skip gravity, the wall
+   tests and integration, and are only tested against awake bodies; a
+   contact with an awake body wakes the whole island again. Islands are
+   rebuilt every tick with union-find over the contacts found.
+*/
+typedef vector< pair<int, int> > Runs;	// (first, count) spans of bodies
+
+class SleepState {
+public:
+	int parent[MAX_BODIES];
+	int settled[MAX_BODIES];	// fewest still ticks in the island, kept at its root
+	int label[MAX_BODIES];		// island number handed out at each root
+	int next_island;
+
+	bool wood_dirty;		// a wood block slept or woke since refreshWood()
+	float wood_radius;
+	vector<int> awake_wood, sleeping_wood;
+	Runs wood_runs;
+
+	int find(int i) {
+		while (parent[i] != i)
+			i = parent[i] = parent[parent[i]];
+		return i;
+	}
+
+	void join(int a, int b) {
+		parent[find(a)] = find(b);
+	}
+};
+
+// Splits the first n bodies of C into runs of awake bodies
+void awakeRuns(Character *C, int n, Runs& runs) {
+	runs.clear();
+	for (int i=0; i<n; i++) {
+		if (C[i].sleeping)
+			continue;
+		if (!runs.empty() && runs.back().first + runs.back().second == i)
+			runs.back().second++;
+		else
+			runs.push_back(make_pair(i, 1));
+	}
+}
+
+/**
+   Collision events. The narrowphase only appends to the queue, and
+   resolveEvents() applies kills, scoring and enemies_left in one place
+   once all the body pairs for the tick have been tested. A body hit
+   twice in one tick is only killed once. Until then a body with a kill
+   waiting, flagged BODY_DOOMED, counts as dead wherever it used to be
+   dead already, so that only the pass that killed it still sees it.
+*/
+enum event_type {EV_KILL=0};
+
+struct Event {
+	int type;
+	int body;	// body id the event applies to
+	int by;		// body id that caused it
+};
+
+class EventQueue {
+public:
+	vector<Event> events;
+
+	void post(int type, int body, int by) {
+		Event e = {type, body, by};
+		events.push_back(e);
+	}
+};
+
+/**
+   Small work-stealing thread pool. run() deals job indices out over one
+   deque per thread; a thread pops from the back of its own deque and,
+   once that is empty, steals from the front of the others. The calling
+   thread works as thread 0, so a pool of one runs every job inline.
+*/
+#define POOL_MIN_WORK 64	// fewest bodies or pairs in a pass worth waking the pool for
+
+class ThreadPool {
+public:
+	struct Queue {
+		mutex lock;
+		deque<int> jobs;
+	};
+
+	int threads;
+	vector<thread> workers;
+	vector<Queue*> queues;
+	function<void(int, int)> task;
+	atomic<int> pending;
+	int generation;
+	bool stopping;
+	mutex lock;
+	condition_variable wakeup, finished;
+
+	ThreadPool() : threads(1), generation(0), stopping(false) {
+		pending = 0;
+		queues.push_back(new Queue);
+	}
+
+	~ThreadPool() {
+		stop();
+		for (size_t t=0; t<queues.size(); t++)
+			delete queues[t];
+	}
+
+	void start(int n) {
+		stop();
+		threads = max(1, n);
+		while ((int)queues.size() < threads)
+			queues.push_back(new Queue);
+		for (int t=1; t<threads; t++)
+			workers.push_back(thread(&ThreadPool::work, this, t));
+	}
+
+	void stop() {
+		{
+			lock_guard<mutex> hold(lock);
+			stopping = true;
+		}
+		wakeup.notify_all();
+		for (size_t t=0; t<workers.size(); t++)
+			workers[t].join();
+		workers.clear();
+		stopping = false;
+		threads = 1;
+	}
+
+	// Own queue from the back, everyone else's from the front
+	bool next(int self, int& job) {
+		for (int k=0; k<threads; k++) {
+			Queue *q = queues[(self+k)%threads];
+			lock_guard<mutex> hold(q->lock);
+			if (q->jobs.empty())
+				continue;
+			if (k == 0) {
+				job = q->jobs.back();
+				q->jobs.pop_back();
+			}
+			else {
+				job = q->jobs.front();
+				q->jobs.pop_front();
+			}
+			return true;
+		}
+		return false;
+	}
+
+	void drain(int self) {
+		int job;
+		while (next(self, job)) {
+			task(job, self);
+			if (--pending == 0) {
+				lock_guard<mutex> hold(lock);
+				finished.notify_all();
+			}
+		}
+	}
+
+	void work(int self) {
+		int seen = generation;
+		while (true) {
+			{
+				unique_lock<mutex> hold(lock);
+				while (!stopping && generation == seen)
+					wakeup.wait(hold);
+				if (stopping)
+					return;
+				seen = generation;
+			}
+			drain(self);
+		}
+	}
+
+	// Calls fn(job, thread) for every job in [0, jobs) and waits for all of them
+	void run(int jobs, const function<void(int, int)>& fn) {
+		if (threads == 1 || jobs < 2) {
+			for (int j=0; j<jobs; j++)
+				fn(j, 0);
+			return;
+		}
+		task = fn;
+		pending = jobs;
+		for (int j=0; j<jobs; j++) {
+			Queue *q = queues[j%threads];
+			lock_guard<mutex> hold(q->lock);
+			q->jobs.push_back(j);
+		}
+		{
+			lock_guard<mutex> hold(lock);
+			generation++;
+		}
+		wakeup.notify_all();
+		drain(0);
+		unique_lock<mutex> hold(lock);
+		while (pending > 0)
+			finished.wait(hold);
+	}
+} Pool, Serial;	// Serial never starts workers, so its run() is a plain loop
+
+/**
+   One game world: the level, its bodies and all the physics state that
+   gravity() steps. Worlds share nothing but the read-only tables, so any
+   number of them can be stepped at once, each on one thread at a time.
+   Collision detection inside a world is split over pool.
+*/
+class World {
+public:
+	Character Wood[MAX_WOOD], Enemies[MAX_ENEMY], Bird[MAX_BIRD];
+	int bird_count;
+	int enemies_left;
+	Wall Floor, CWall;	// walls 0 and 1
+	vector<Wall> Platforms;	// walls 2 onwards
+	WallTree Walls;
+	vector<int> wall_leaf;	// tree leaf of each wall, -1 once removed
+	Weapon Cannon;
+	Player Player1;
+
+	BodyStore Bodies;
+	Grid WoodGrid, SleepGrid;
+	float wood_speed;	// fastest awake wood in WoodGrid, per component
+	SleepState Sleep;
+	SweepAndPrune Sap;
+	EventQueue Events;
+	ThreadPool *pool;
+
+	// Scratch space for gravity(), kept between ticks to save reallocating
+	Runs birds, enemies;
+	vector<int> dynamic, falling, ids, found;
+	vector<int> wall_start, wall_count, wall_hits;	// walls each body may reach this tick
+	vector<int> touches, contacts, steps;
+	vector<float> fastest, held;
+	vector< pair<int, int> > violent;	// (island root, body) of the bodies to substep
+	vector<glm::vec2> from;
+	vector< pair<int, int> > pairs, enemyPairs, contactPairs;
+	vector< vector< pair<int, int> > > birdFound, enemyFound;
+	vector< vector<int> > scratch;
+	vector<int> link, pairGroup, groupStart, grouped;	// resolvePairs() groups
+	vector<char> hit;
+
+	World() : pool(&Pool) {
+		WoodGrid.cell = SleepGrid.cell = 0;
+		wood_speed = 0;
+		Sleep.next_island = 0;
+		createFloor();
+		createWall();
+		addWall(Floor);
+		addWall(CWall);
+		createCannon();
+		reset();
+	}
+
+	Character& body(int id);
+	Wall& wall(int id);
+	int addWall(const Wall& W);
+	void moveWall(int id, float x, float y);
+	void removeWall(int id);
+	void reachWalls(int id);
+	void hitWalls(int id, bool drag);
+	bool canSleep(int id);
+	void wake(int id);
+	void fallAsleep(int id, int island);
+	float woodReach(float reach);
+	bool refreshWood(float reach);
+	void binWood();
+	void gatherRuns(Character *C, int base, int mat, const Runs& runs);
+	void scatterRuns(Character *C, int base, const Runs& runs);
+	void resolveEvents();
+	void contact(int a, int b, int killB);
+	bool doomed(int id);
+	bool collide(int a, int b, int killB);
+	ThreadPool *poolFor(size_t work);
+	void resolvePairs(const vector< pair<int, int> >& ab, int killB);
+	void awakeIds(const Runs& birds, const Runs& enemies);
+	void settle(const Runs& birds, const Runs& enemies);
+	void planSubsteps(const Runs& birds, const Runs& enemies);
+	void touch(int id);
+	void substep();
+	void nearWood(Character& C, vector<int>& out);
+	void detectWood(vector< pair<int, int> >& birdPairs, vector< pair<int, int> >& enemyPairs);
+	void sweepAndPrune(vector< pair<int, int> >& birdPairs, vector< pair<int, int> >& enemyPairs);
+	float impactTime(int id);
+	void sweep(int first, int n);
+	void gravity();
+	void step();
+
+	void createBird(int index, float x, float y);
+	void fire_bird();
+	void shoot(float angle, float power);
+	void createEnemies();
+	void createWall();
+	void createFloor();
+	void createWood();
+	void createCannon();
+	void reset();
+	void observe(float *out);
+};
+
+Character& World::body(int id) {
+	if (id < ENEMY_BASE)
+		return Bird[id-BIRD_BASE];
+	if (id < WOOD_BASE)
+		return Enemies[id-ENEMY_BASE];
+	return Wood[id-WOOD_BASE];
+}
+
+Wall& World::wall(int id) {
+	if (id == 0)
+		return Floor;
+	if (id == 1)
+		return CWall;
+	return Platforms[id-2];
+}
+
+/* Puts W in the tree and returns its wall id. Floor and CWall are
+   added first by the constructor, as walls 0 and 1; W is copied to
+   Platforms for any later wall */
+int World::addWall(const Wall& W) {
+	int id = (int)wall_leaf.size();
+	if (id >= 2)
+		Platforms.push_back(W);
+	glm::vec2 half(W.size_x, W.size_y), center(W.x, W.y);
+	wall_leaf.push_back(Walls.insert(id, center - half, center + half));
+	return id;
+}
+
+// Moves a kinematic wall, refitting its leaf
+void World::moveWall(int id, float x, float y) {
+	Wall& W = wall(id);
+	W.x = x;
+	W.y = y;
+	if (wall_leaf[id] < 0)
+		return;
+	glm::vec2 half(W.size_x, W.size_y), center(W.x, W.y);
+	wall_leaf[id] = Walls.refit(wall_leaf[id], center - half, center + half);
+}
+
+// Takes a wall out of the tree; its id is not handed out again
+void World::removeWall(int id) {
+	if (wall_leaf[id] < 0)
+		return;
+	Walls.remove(wall_leaf[id]);
+	wall_leaf[id] = -1;
+}
+
+/* Queries the tree once for the walls body id may reach this tick,
+   for the wall tests, the swept tests and the substeps alike. The box
+   is swept both ways, as a bounce in this same tick can turn the body
+   round before it moves */
+void World::reachWalls(int id) {
+	Character& C = body(id);
+	glm::vec2 reach = glm::abs(C.Vel) + glm::vec2(C.radius + WALL_MARGIN);
+	glm::vec2 center(C.x, C.y);
+	wall_start[id] = (int)wall_hits.size();
+	Walls.query(center - reach, center + reach, wall_hits);
+	wall_count[id] = (int)wall_hits.size() - wall_start[id];
+}
+
+/**
+   The wall tests for body id. The air drag was tuned with every body
+   tested against Floor and CWall, paying it at each miss, so those two
+   are still tested every tick in the order they always were: birds
+   meet the floor first, enemies the cannon wall. Any other wall comes
+   from the tree, is only tested when near and charges no drag. The
+   substeps pass drag false, so that the drag is paid once per tick.
+*/
+void World::hitWalls(int id, bool drag) {
+	Character& C = body(id);
+	int first = id < ENEMY_BASE ? 0 : 1;
+	for (int k=0; k<TUNED_WALLS; k++) {
+		int w = first ^ k;
+		if (wall_leaf[w] < 0)
+			continue;
+		if (drag)
+			MoveFixedColl(wall(w), C);
+		else
+			FixedColl(wall(w), C);
+	}
+	for (int k=0; k<wall_count[id]; k++) {
+		int w = wall_hits[wall_start[id]+k];
+		if (w >= TUNED_WALLS)
+			FixedColl(wall(w), C);
+	}
+}
+
+// Dead wood has nothing left to rest on, so it is never put to sleep
+bool World::canSleep(int id) {
+	return id < WOOD_BASE || body(id).alive;
+}
+
+void World::wake(int id) {
+	Character& C = body(id);
+	if (!C.sleeping)
+		return;
+	int island = C.island;
+	for (int b=0; b<WOOD_BASE+WOOD_NUMBER; b++) {
+		if (b >= BIRD_BASE+bird_count && b < ENEMY_BASE)
+			continue;
+		if (b >= ENEMY_BASE+ENEMY_NUMBER && b < WOOD_BASE)
+			continue;
+		Character& M = body(b);
+		if (!M.sleeping || M.island != island)
+			continue;
+		M.sleeping = 0;
+		M.still = 0;
+		Sleep.parent[b] = b;
+		if (b >= WOOD_BASE)
+			Sleep.wood_dirty = true;
+	}
+}
+
+void World::fallAsleep(int id, int island) {
+	Character& C = body(id);
+	C.sleeping = 1;
+	C.island = island;
+	C.Vel = glm::vec2(0, 0);
+	C.px = C.x;
+	C.py = C.y;
+	if (id >= WOOD_BASE)
+		Sleep.wood_dirty = true;
+}
+
+/* How near a wood block has to be for a body of radius up to reach to
+   be tested against it. A contact pushes a bird or enemy out by up to
+   the radius sum, which can carry it onto wood it was not near when
+   the pairs were found, so the reach covers that push too */
+float World::woodReach(float reach) {
+	return 2*(reach + Sleep.wood_radius);
+}
+
+// Rebuilds the wood lists and the sleeping wood grid after sleep changes
+bool World::refreshWood(float reach) {
+	if (!Sleep.wood_dirty && SleepGrid.cell >= woodReach(reach))
+		return false;
+	Sleep.wood_dirty = false;
+	Sleep.wood_radius = maxRadius(Wood, WOOD_NUMBER);
+	Sleep.awake_wood.clear();
+	Sleep.sleeping_wood.clear();
+	for (int i=0; i<WOOD_NUMBER; i++) {
+		if (!Wood[i].sleeping)
+			Sleep.awake_wood.push_back(i);
+		else if (Wood[i].alive)
+			Sleep.sleeping_wood.push_back(i);
+	}
+	awakeRuns(Wood, WOOD_NUMBER, Sleep.wood_runs);
+	SleepGrid.build(Wood, WOOD_NUMBER, Sleep.sleeping_wood, max(0.01f, woodReach(reach)));
+	return true;
+}
+
+// Bins the awake wood that is still alive into WoodGrid
+void World::binWood() {
+	dynamic.clear();
+	wood_speed = 0;
+	for (size_t k=0; k<Sleep.awake_wood.size(); k++) {
+		Character& W = Wood[Sleep.awake_wood[k]];
+		if (!W.alive)
+			continue;
+		dynamic.push_back(Sleep.awake_wood[k]);
+		wood_speed = max(wood_speed, max(fabs(W.Vel[0]), fabs(W.Vel[1])));
+	}
+	WoodGrid.build(Wood, WOOD_NUMBER, dynamic, SleepGrid.cell);
+}
+
+void World::gatherRuns(Character *C, int base, int mat, const Runs& runs) {
+	for (size_t r=0; r<runs.size(); r++)
+		Bodies.gather(C+runs[r].first, base+runs[r].first, runs[r].second, mat);
+}
+
+void World::scatterRuns(Character *C, int base, const Runs& runs) {
+	for (size_t r=0; r<runs.size(); r++)
+		Bodies.scatter(C+runs[r].first, base+runs[r].first, runs[r].second);
+}
+
+void World::resolveEvents() {
+	for (size_t k=0; k<Events.events.size(); k++) {
+		Event& e = Events.events[k];
+		switch (e.type) {
+		case EV_KILL: {
+			Bodies.flags[e.body] &= ~BODY_DOOMED;
+			Character& B = body(e.body);
+			if (!B.alive)
+				break;
+			B.alive = 0;
+			Player1.score += 10;
+			if (e.body >= ENEMY_BASE && e.body < WOOD_BASE)
+				enemies_left--;
+			// A wood block picks up falling speed once per remaining bird
+			if (e.body >= WOOD_BASE && e.by < ENEMY_BASE)
+				for (int j=e.by-BIRD_BASE; j<bird_count; j++)
+					B.Vel[1] -= GRAV_CONST*0.1;
+			break;
+		}
+		}
+	}
+	Events.events.clear();
+}
+
+// What a contact does besides the push: wakes both islands, joins them and posts a kill
+void World::contact(int a, int b, int killB) {
+	wake(a);
+	wake(b);
+	Sleep.join(a, b);
+	touches[a]++;
+	touches[b]++;
+	if (killB && killB != 3) {
+		Events.post(EV_KILL, b, a);
+		Bodies.flags[b] |= BODY_DOOMED;
+	}
+}
+
+// Whether body id has a kill waiting to be resolved
+bool World::doomed(int id) {
+	return Bodies.flags[id] & BODY_DOOMED;
+}
+
+// MovMovColl on two bodies by id, waking and joining them on contact
+bool World::collide(int a, int b, int killB) {
+	Character &A = body(a), &B = body(b);
+	if (A.sleeping && B.sleeping)
+		return false;
+	// As MovMovColl() skips a dead B
+	if (killB != 2 && doomed(b))
+		return false;
+	if (!MovMovColl(A, B, killB))
+		return false;
+	contact(a, b, killB);
+	return true;
+}
+
+// The pool for a pass over this many bodies or pairs; small passes run inline
+ThreadPool *World::poolFor(size_t work) {
+	return work >= POOL_MIN_WORK ? pool : &Serial;
+}
+
+/**
+   collide() over the pairs (a, b) in order. The caller leaves out the
+   pairs collide() would turn away as the pass starts: both asleep, as
+   nearWood() never finds, or b already doomed. A push only changes the
+   two bodies it is between, so pairs are grouped by the bodies they share, union-find again, and
+   each group runs its MovMovColl() tests in order on one thread. Waking,
+   joining and kills then follow serially in pair order, so the outcome
+   is the same for any thread count.
+*/
+void World::resolvePairs(const vector< pair<int, int> >& ab, int killB) {
+	ThreadPool *p = poolFor(ab.size());
+	if (p->threads == 1) {
+		for (size_t k=0; k<ab.size(); k++)
+			collide(ab[k].first, ab[k].second, killB);
+		return;
+	}
+
+	link.resize(MAX_BODIES);
+	for (size_t k=0; k<ab.size(); k++) {
+		link[ab[k].first] = ab[k].first;
+		link[ab[k].second] = ab[k].second;
+	}
+	auto root = [this](int i) {
+		while (link[i] != i)
+			i = link[i] = link[link[i]];
+		return i;
+	};
+	for (size_t k=0; k<ab.size(); k++)
+		link[root(ab[k].first)] = root(ab[k].second);
+
+	// Groups numbered in order of their first pair, then counting sorted
+	pairGroup.resize(ab.size());
+	for (size_t k=0; k<ab.size(); k++)
+		pairGroup[k] = root(ab[k].first);
+	for (size_t k=0; k<ab.size(); k++)
+		link[pairGroup[k]] = -1;
+	int groups = 0;
+	groupStart.assign(1, 0);
+	for (size_t k=0; k<ab.size(); k++) {
+		int r = pairGroup[k];
+		if (link[r] == -1) {
+			link[r] = -2 - groups++;
+			groupStart.push_back(0);
+		}
+		pairGroup[k] = -2 - link[r];
+		groupStart[pairGroup[k]+1]++;
+	}
+	for (int g=0; g<groups; g++)
+		groupStart[g+1] += groupStart[g];
+	grouped.resize(ab.size());
+	for (size_t k=0; k<ab.size(); k++)
+		grouped[groupStart[pairGroup[k]]++] = k;
+	for (int g=groups; g>0; g--)
+		groupStart[g] = groupStart[g-1];
+	groupStart[0] = 0;
+
+	hit.assign(ab.size(), 0);
+	p->run(groups, [this, &ab, killB](int g, int t) {
+		for (int m=groupStart[g]; m<groupStart[g+1]; m++) {
+			int k = grouped[m];
+			hit[k] = MovMovColl(body(ab[k].first), body(ab[k].second), killB);
+		}
+	});
+	for (size_t k=0; k<ab.size(); k++)
+		if (hit[k])
+			contact(ab[k].first, ab[k].second, killB);
+}
+
+// Lists the awake bodies in ids, birds then enemies then wood
+void World::awakeIds(const Runs& birds, const Runs& enemies) {
+	ids.clear();
+	for (size_t r=0; r<birds.size(); r++)
+		for (int i=0; i<birds[r].second; i++)
+			ids.push_back(BIRD_BASE+birds[r].first+i);
+	for (size_t r=0; r<enemies.size(); r++)
+		for (int i=0; i<enemies[r].second; i++)
+			ids.push_back(ENEMY_BASE+enemies[r].first+i);
+	for (size_t k=0; k<Sleep.awake_wood.size(); k++)
+		ids.push_back(WOOD_BASE+Sleep.awake_wood[k]);
+}
+
+// Counts still ticks and puts every fully settled island to sleep
+void World::settle(const Runs& birds, const Runs& enemies) {
+	awakeIds(birds, enemies);
+	for (size_t k=0; k<ids.size(); k++) {
+		Character& C = body(ids[k]);
+		if (canSleep(ids[k]) && abs(C.Vel[0]) < VEL_THRE && abs(C.Vel[1]) < VEL_THRE)
+			C.still++;
+		else
+			C.still = 0;
+		int root = Sleep.find(ids[k]);
+		Sleep.settled[root] = SLEEP_TICKS;
+		Sleep.label[root] = -1;
+	}
+	for (size_t k=0; k<ids.size(); k++) {
+		int root = Sleep.find(ids[k]);
+		Sleep.settled[root] = min(Sleep.settled[root], body(ids[k]).still);
+	}
+	for (size_t k=0; k<ids.size(); k++) {
+		int root = Sleep.find(ids[k]);
+		if (Sleep.settled[root] < SLEEP_TICKS)
+			continue;
+		if (Sleep.label[root] < 0)
+			Sleep.label[root] = Sleep.next_island++;
+		fallAsleep(ids[k], Sleep.label[root]);
+	}
+}
+
+// Wood blocks within reach of C, in ascending order
+void World::nearWood(Character& C, vector<int>& out) {
+	out.clear();
+	WoodGrid.query(C.x, C.y, out);
+	if (!C.sleeping) {
+		size_t mid = out.size();
+		SleepGrid.query(C.x, C.y, out);
+		inplace_merge(out.begin(), out.begin()+mid, out.end());
+	}
+	float reach = WoodGrid.cell;
+	size_t kept = 0;
+	for (size_t k=0; k<out.size(); k++) {
+		float dx = Wood[out[k]].x - C.x, dy = Wood[out[k]].y - C.y;
+		if (dx*dx + dy*dy <= reach*reach)
+			out[kept++] = out[k];
+	}
+	out.resize(kept);
+}
+
+/**
+   Finds Bird x Wood and Enemy x Wood candidates, one job per bird or
+   enemy, into per-thread buffers. The buffers are then merged and sorted,
+   so the pairs come out in the same order whatever the thread count:
+   bird pairs as (wood, bird) and enemy pairs as (enemy, wood).
+*/
+void World::detectWood(vector< pair<int, int> >& birdPairs, vector< pair<int, int> >& enemyPairs) {
+	ThreadPool *p = poolFor(bird_count + ENEMY_NUMBER);
+	birdFound.resize(p->threads);
+	enemyFound.resize(p->threads);
+	scratch.resize(p->threads);
+	for (int t=0; t<p->threads; t++) {
+		birdFound[t].clear();
+		enemyFound[t].clear();
+	}
+
+	int birds = bird_count;
+	p->run(bird_count + ENEMY_NUMBER, [this, birds](int job, int t) {
+		vector<int>& nearby = scratch[t];
+		if (job < birds) {
+			nearWood(Bird[job], nearby);
+			for (size_t k=0; k<nearby.size(); k++)
+				birdFound[t].push_back(make_pair(nearby[k], job));
+		}
+		else {
+			int i = job - birds;
+			nearWood(Enemies[i], nearby);
+			for (size_t k=0; k<nearby.size(); k++)
+				enemyFound[t].push_back(make_pair(i, nearby[k]));
+		}
+	});
+
+	birdPairs.clear();
+	enemyPairs.clear();
+	for (int t=0; t<p->threads; t++) {
+		birdPairs.insert(birdPairs.end(), birdFound[t].begin(), birdFound[t].end());
+		enemyPairs.insert(enemyPairs.end(), enemyFound[t].begin(), enemyFound[t].end());
+	}
+	sort(birdPairs.begin(), birdPairs.end());
+	sort(enemyPairs.begin(), enemyPairs.end());
+}
+
+/* detectWood() through the sweep and prune lists. Dead wood stays in
+   the lists, so a block dying does not cost a rebuild, but is skipped.
+   Birds and enemies get boxes as wide as the grid's reach */
+void World::sweepAndPrune(vector< pair<int, int> >& birdPairs, vector< pair<int, int> >& enemyPairs) {
+	float half = WoodGrid.cell - Sleep.wood_radius;
+	Sap.track(bird_count, ENEMY_NUMBER, WOOD_NUMBER);
+	for (int j=0; j<bird_count; j++)
+		Sap.bounds(BIRD_BASE+j, Bird[j], half, true);
+	for (int i=0; i<ENEMY_NUMBER; i++)
+		Sap.bounds(ENEMY_BASE+i, Enemies[i], half, true);
+	for (int i=0; i<WOOD_NUMBER; i++)
+		Sap.bounds(WOOD_BASE+i, Wood[i], Wood[i].radius, Wood[i].alive);
+
+	birdPairs.clear();
+	enemyPairs.clear();
+	Sap.find(birdPairs, enemyPairs);
+	sort(birdPairs.begin(), birdPairs.end());
+	sort(enemyPairs.begin(), enemyPairs.end());
+}
+
+// Fraction of its move this tick body id makes before it first touches something
+float World::impactTime(int id) {
+	glm::vec2 p(Bodies.x[id], Bodies.y[id]), d(Bodies.vx[id], Bodies.vy[id]);
+	float r = Bodies.radius[id];
+	// Sinking in by less than its radius is left to the discrete tests
+	float t = 1;
+	for (int k=0; k<wall_count[id]; k++)
+		t = min(t, sweepBox(p, d, r, r, wall(wall_hits[wall_start[id]+k])));
+	for (int i=0; i<ENEMY_NUMBER; i++) {
+		Character& E = Enemies[i];
+		if (ENEMY_BASE+i != id && E.alive)
+			t = min(t, sweepCircle(p - glm::vec2(E.x, E.y), d - E.Vel, r + E.radius, r));
+	}
+	// Wood only comes from the grid cells the move passes over, padded by
+	// the wood's own move; enemies are few and tested all against all anyway
+	glm::vec2 lo = glm::min(p, p + d) - glm::vec2(wood_speed), hi = glm::max(p, p + d) + glm::vec2(wood_speed);
+	found.clear();
+	WoodGrid.queryBox(lo.x, lo.y, hi.x, hi.y, found);
+	SleepGrid.queryBox(lo.x, lo.y, hi.x, hi.y, found);
+	for (size_t k=0; k<found.size(); k++) {
+		Character& W = Wood[found[k]];
+		t = min(t, sweepCircle(p - glm::vec2(W.x, W.y), d - W.Vel, r + W.radius, r));
+	}
+	return t;
+}
+
+/* Bodies moving further than their radius in a tick can pass right
+   through a block between two discrete tests. Those are held back so
+   that the integration after this stops them where they first touch,
+   keeping their velocity for the contact next tick */
+void World::sweep(int first, int n) {
+	for (int id=first; id<first+n; id++) {
+		float vx = Bodies.vx[id], vy = Bodies.vy[id], r = Bodies.radius[id];
+		if (vx*vx + vy*vy <= r*r)
+			continue;
+		float t = impactTime(id);
+		// Held bodies stop SWEEP_SKIN into the shape, where the discrete
+		// tests meet it next tick
+		if (t < 1)
+			t = min(1.0f, t + (float)SWEEP_SKIN/sqrt(vx*vx + vy*vy));
+		Bodies.x[id] -= vx*(1-t);
+		Bodies.y[id] -= vy*(1-t);
+	}
+}
+
+/**
+   Picks the islands that get more than one step this tick: those whose
+   fastest body moves further than SUBSTEP_SPEED, split so no substep
+   does, and those with SUBSTEP_CONTACTS or more contacts, split in two.
+   Their bodies go into violent, grouped by island, with their positions
+   before the move in from. Everything else keeps the single step.
+*/
+void World::planSubsteps(const Runs& birds, const Runs& enemies) {
+	violent.clear();
+	from.clear();
+	if (!adaptive_substeps)
+		return;
+	awakeIds(birds, enemies);
+	fastest.resize(MAX_BODIES);
+	contacts.resize(MAX_BODIES);
+	steps.resize(MAX_BODIES);
+	for (size_t k=0; k<ids.size(); k++) {
+		int root = Sleep.find(ids[k]);
+		fastest[root] = 0;
+		contacts[root] = 0;
+	}
+	for (size_t k=0; k<ids.size(); k++) {
+		Character& C = body(ids[k]);
+		int root = Sleep.find(ids[k]);
+		fastest[root] = max(fastest[root], glm::length(C.Vel));
+		contacts[root] += touches[ids[k]];
+	}
+	for (size_t k=0; k<ids.size(); k++) {
+		int root = Sleep.find(ids[k]);
+		// Each contact was counted at both of its bodies
+		int K = contacts[root]/2 >= SUBSTEP_CONTACTS ? 2 : 1;
+		K = max(K, (int)ceil(fastest[root]/SUBSTEP_SPEED));
+		steps[root] = min(K, MAX_SUBSTEPS);
+	}
+	for (size_t k=0; k<ids.size(); k++) {
+		int root = Sleep.find(ids[k]);
+		if (steps[root] > 1)
+			violent.push_back(make_pair(root, ids[k]));
+	}
+	sort(violent.begin(), violent.end());
+	for (size_t k=0; k<violent.size(); k++) {
+		Character& C = body(violent[k].second);
+		from.push_back(glm::vec2(C.x, C.y));
+	}
+}
+
+// The discrete tests of gravity() for one body, without the air drag
+void World::touch(int id) {
+	// Wood only meets birds and enemies, and is tested from their side
+	if (id >= WOOD_BASE)
+		return;
+	Character& C = body(id);
+	vector<int>& nearby = found;
+	nearWood(C, nearby);
+	if (id < ENEMY_BASE) {
+		for (int i=0; i<ENEMY_NUMBER; i++)
+			collide(id, ENEMY_BASE+i, 1);
+		for (size_t k=0; k<nearby.size(); k++)
+			if (Wood[nearby[k]].alive)
+				collide(id, WOOD_BASE+nearby[k], 2);
+	}
+	else {
+		for (int i=0; i<ENEMY_NUMBER; i++)
+			if (ENEMY_BASE+i != id)
+				collide(min(id, ENEMY_BASE+i), max(id, ENEMY_BASE+i), 0);
+		for (size_t k=0; k<nearby.size(); k++)
+			if (Wood[nearby[k]].alive && !doomed(WOOD_BASE+nearby[k]))
+				collide(WOOD_BASE+nearby[k], id, 3);
+	}
+	hitWalls(id, false);
+}
+
+/* Replays the move of every violent island in steps[root] equal parts,
+   with the discrete tests between them, so a contact partway through
+   the tick turns the body there rather than a whole tick later. A body
+   sweep() held back keeps the same fraction of each part */
+void World::substep() {
+	held.resize(violent.size());
+	for (size_t m=0; m<violent.size(); m++) {
+		Character& C = body(violent[m].second);
+		glm::vec2 moved = glm::vec2(C.x, C.y) - from[m];
+		float speed = glm::dot(C.Vel, C.Vel);
+		held[m] = speed > 0 ? clamp(glm::dot(moved, C.Vel)/speed, 0.0f, 1.0f) : 1;
+		C.x = from[m][0];
+		C.y = from[m][1];
+	}
+	for (size_t k=0; k<violent.size(); ) {
+		int root = violent[k].first, K = steps[root];
+		size_t end = k;
+		while (end < violent.size() && violent[end].first == root)
+			end++;
+		for (int s=0; s<K; s++) {
+			for (size_t m=k; m<end; m++) {
+				Character& C = body(violent[m].second);
+				C.x += C.Vel[0]*held[m]/K;
+				C.y += C.Vel[1]*held[m]/K;
+			}
+			for (size_t m=k; m<end; m++)
+				touch(violent[m].second);
+		}
+		k = end;
+	}
+	resolveEvents();
+}
+
+void World::gravity() {
+
+	// Cells must span the largest possible radius sum, see woodReach()
+	float reach = max(maxRadius(Bird, bird_count), maxRadius(Enemies, ENEMY_NUMBER));
+	refreshWood(reach);
+
+	awakeRuns(Bird, bird_count, birds);
+	awakeRuns(Enemies, ENEMY_NUMBER, enemies);
+
+	touches.assign(MAX_BODIES, 0);
+
+	// Every awake body starts the tick as its own island
+	for (int j=0; j<bird_count; j++)
+		Sleep.parent[BIRD_BASE+j] = BIRD_BASE+j;
+	for (int i=0; i<ENEMY_NUMBER; i++)
+		Sleep.parent[ENEMY_BASE+i] = ENEMY_BASE+i;
+	for (size_t k=0; k<Sleep.awake_wood.size(); k++)
+		Sleep.parent[WOOD_BASE+Sleep.awake_wood[k]] = WOOD_BASE+Sleep.awake_wood[k];
+
+	gatherRuns(Bird, BIRD_BASE, MAT_BIRD, birds);
+	gatherRuns(Enemies, ENEMY_BASE, MAT_ENEMY, enemies);
+	for (size_t r=0; r<birds.size(); r++)
+		applyGravity(Bodies, BIRD_BASE+birds[r].first, birds[r].second, GRAV_CONST);
+	for (size_t r=0; r<enemies.size(); r++)
+		applyGravity(Bodies, ENEMY_BASE+enemies[r].first, enemies[r].second, GRAV_CONST);
+	scatterRuns(Bird, BIRD_BASE, birds);
+	scatterRuns(Enemies, ENEMY_BASE, enemies);
+
+	// Bird, Enemy
+	for (int i=0; i<ENEMY_NUMBER; i++)
+		for (int j=0; j<bird_count; j++)
+			collide(BIRD_BASE+j, ENEMY_BASE+i, 1);
+
+	// Enemy, Enemy
+	for (int i=0; i<ENEMY_NUMBER; i++)
+		for(int j=i+1; j<ENEMY_NUMBER; j++)
+			collide(ENEMY_BASE+i, ENEMY_BASE+j, 0);
+
+	// Only awake wood is rebinned every tick
+	binWood();
+
+	if (broadphase == BROAD_SAP)
+		sweepAndPrune(pairs, enemyPairs);
+	else
+		detectWood(pairs, enemyPairs);
+
+	// Wood Bird
+	// A dead wood block picks up falling speed once per bird
+	falling.clear();
+	for (size_t k=0; k<Sleep.awake_wood.size(); k++)
+		if (!Wood[Sleep.awake_wood[k]].alive)
+			falling.push_back(Sleep.awake_wood[k]);
+	contactPairs.clear();
+	for (size_t k=0; k<pairs.size(); k++) {
+		int i = pairs[k].first, j = pairs[k].second;
+		if (Wood[i].alive && !(Bird[j].sleeping && Wood[i].sleeping))
+			contactPairs.push_back(make_pair(BIRD_BASE+j, WOOD_BASE+i));
+	}
+	resolvePairs(contactPairs, 2);
+	for (size_t k=0; k<falling.size(); k++)
+		for (int j=0; j<bird_count; j++)
+			Wood[falling[k]].Vel[1] -= GRAV_CONST*0.1;
+
+	//Enemy Wood
+	contactPairs.clear();
+	for (size_t k=0; k<enemyPairs.size(); k++) {
+		int i = enemyPairs[k].first, j = enemyPairs[k].second;
+		if (!Wood[j].alive || doomed(WOOD_BASE+j) || doomed(ENEMY_BASE+i))
+			continue;
+		if (!(Wood[j].sleeping && Enemies[i].sleeping))
+			contactPairs.push_back(make_pair(WOOD_BASE+j, ENEMY_BASE+i));
+	}
+	resolvePairs(contactPairs, 3);
+
+	resolveEvents();
+
+	// Bird Wall, Enemy Wall
+	wall_start.resize(MAX_BODIES);
+	wall_count.assign(MAX_BODIES, 0);
+	wall_hits.clear();
+	for (int j=0; j<bird_count; j++)
+		if (!Bird[j].sleeping) {
+			reachWalls(BIRD_BASE+j);
+			hitWalls(BIRD_BASE+j, true);
+		}
+	for (int i=0; i<ENEMY_NUMBER; i++)
+		if (!Enemies[i].sleeping) {
+			reachWalls(ENEMY_BASE+i);
+			hitWalls(ENEMY_BASE+i, true);
+		}
+
+	// Bodies woken by a contact this tick move with the rest
+	awakeRuns(Bird, bird_count, birds);
+	awakeRuns(Enemies, ENEMY_NUMBER, enemies);
+	// Wood they woke has left SleepGrid, so it goes into WoodGrid for the
+	// swept tests and the substeps
+	if (refreshWood(reach))
+		binWood();
+	planSubsteps(birds, enemies);
+
+	gatherRuns(Bird, BIRD_BASE, MAT_BIRD, birds);
+	gatherRuns(Enemies, ENEMY_BASE, MAT_ENEMY, enemies);
+	gatherRuns(Wood, WOOD_BASE, MAT_WOOD, Sleep.wood_runs);
+
+	for (size_t r=0; r<birds.size(); r++) {
+		int first = BIRD_BASE+birds[r].first, n = birds[r].second;
+		clampVelocity(Bodies, first, n, BIRD_SPEED_CAP);
+		sweep(first, n);
+		integrate(Bodies, first, n);
+	}
+	for (size_t r=0; r<enemies.size(); r++) {
+		int first = ENEMY_BASE+enemies[r].first, n = enemies[r].second;
+		sweep(first, n);
+		integrate(Bodies, first, n);
+	}
+	for (size_t r=0; r<Sleep.wood_runs.size(); r++)
+		integrate(Bodies, WOOD_BASE+Sleep.wood_runs[r].first, Sleep.wood_runs[r].second);
+
+	scatterRuns(Bird, BIRD_BASE, birds);
+	scatterRuns(Enemies, ENEMY_BASE, enemies);
+	scatterRuns(Wood, WOOD_BASE, Sleep.wood_runs);
+
+	// The vectorised step above gave these their new velocities
+	substep();
+	settle(birds, enemies);
+}
+
+void savePositions(Character *C, int n) {
+	for (int i=0; i<n; i++) {
+		C[i].px = C[i].x;
+		C[i].py = C[i].y;
+	}
+}
+
+/* One physics tick */
+void World::step() {
+	savePositions(Bird, bird_count);
+	savePositions(Enemies, ENEMY_NUMBER);
+	// Sleeping wood already has its previous position equal to its position
+	for (size_t r=0; r<Sleep.wood_runs.size(); r++)
+		savePositions(Wood+Sleep.wood_runs[r].first, Sleep.wood_runs[r].second);
+	gravity();
+}
+
+/**
+   Fixed timestep scheduler. Real time is banked in an accumulator and
+   spent in whole ticks, at most max_steps per frame; anything beyond
+   that is dropped so a long stall does not turn into a burst of
+   catch-up ticks. alpha is how far the current frame sits between the
+   last two ticks.
+*/
+class Scheduler {
+public:
+	double tick;
+	int max_steps;
+	double accumulator, last;
+	float alpha;
+
+	void start(double now, double rate, int steps) {
+		tick = 1.0/rate;
+		max_steps = steps;
+		accumulator = 0;
+		last = now;
+		alpha = 0;
+	}
+
+	// Returns how many ticks are due at time now
+	int due(double now) {
+		accumulator += now - last;
+		last = now;
+		int steps = 0;
+		while (accumulator >= tick && steps < max_steps) {
+			accumulator -= tick;
+			steps++;
+		}
+		if (accumulator >= tick)
+			accumulator = fmod(accumulator, tick);
+		alpha = accumulator/tick;
+		return steps;
+	}
+} Clock;
+
+/********************
+ * World setup      *
+ ********************/
+
+void World::createBird (int index, float x, float y)
+{
+	Bird[index].health = 5;
+	Bird[index].x = x;
+	Bird[index].alive = 1;
+	Bird[index].y = y;
+	Bird[index].radius = BIRD_RADIUS;
+	Bird[index].Vel = glm::vec2(0, 0);
+	Bird[index].px = Bird[index].x;
+	Bird[index].py = Bird[index].y;
+	Bird[index].sleeping = 0;
+	Bird[index].still = 0;
+	Bird[index].island = -1;
+	setMaterial(Bird[index], MAT_BIRD);
+}
+
+void World::fire_bird() {
+	if(bird_count >= MAX_SHOTS)
+		return;
+	createBird(bird_count, Cannon.x, Cannon.y);
+	Bird[bird_count].Vel = glm::vec2(
+		Cannon.power * 0.2 * cos((Cannon.angle*M_PI)/180),
+		Cannon.power * 0.2 * sin((Cannon.angle*M_PI)/180)
+		);
+	bird_count++;
+}
+
+void World::createEnemies ()
+{
+	Enemies[0].x =2;
+	Enemies[0].y =0;
+	Enemies[1].x =8;
+	Enemies[1].y =-2;
+	Enemies[2].x =8.5;
+	Enemies[2].y =-2;
+	Enemies[3].x =9;
+	Enemies[3].y =-2;
+	Enemies[4].x =4;
+	Enemies[4].y =-2.5;
+	Enemies[5].x =8.6;
+	Enemies[5].y =1.3;
+	for (int i=0; i<ENEMY_NUMBER ;i++) {
+		Enemies[i].radius = 0.2;
+		Enemies[i].Vel = glm::vec2(0, 0);
+		Enemies[i].px = Enemies[i].x;
+		Enemies[i].py = Enemies[i].y;
+		Enemies[i].sleeping = 0;
+		Enemies[i].still = 0;
+		Enemies[i].island = -1;
+		Enemies[i].alive = 1;
+		setMaterial(Enemies[i], MAT_ENEMY);
+	}
+}
+
+void World::createWall ()
+{
+	CWall.x = 0;
+	CWall.y = -2;
+	CWall.size_x = 0.5;
+	CWall.size_y = 1.09;
+}
+
+void World::createFloor ()
+{
+	Floor.x = 0;
+	Floor.y = -3.5;
+	Floor.size_x = 400;
+	Floor.size_y = 0.5;
+}
+
+void World::createWood ()
+{
+	{
+		for (int i=0; i<MAX_WOOD ;i++) {
+			if(i<30) {
+				Wood[i].x = 5.5+i*0.2;
+				Wood[i].y = -2.9;
+			}
+            else if(i<60) {
+				Wood[i].x = 5.5+(i-30)*0.2;
+				Wood[i].y = -2.9;
+			}
+			else if(i<86) {
+				Wood[i].x = 5.9+(i-60)*0.2;
+				Wood[i].y = -2.7;
+			}
+            else if(i<112) {
+				Wood[i].x = 5.9+(i-86)*0.2;
+				Wood[i].y = -2.7;
+			}
+
+			// Pillar #1
+			else if(i<125) {
+				Wood[i].x = 6.5;
+				Wood[i].y = -2.5+(i-112)*0.2;
+			}
+			else if(i<138) {
+				Wood[i].x = 6.7;
+				Wood[i].y = -2.5+(i-125)*0.2;
+			}
+			else if(i<151) {
+				Wood[i].x = 9.9;
+				Wood[i].y = -2.5+(i-138)*0.2;
+			}
+
+			// Pillar #2
+			else if(i<164) {
+				Wood[i].x = 10.1;
+				Wood[i].y = -2.5+(i-151)*0.2;
+			}
+			else if(i<177) {
+				Wood[i].x = 10.3;
+				Wood[i].y = -2.5+(i-164)*0.2;
+			}
+			else if(i<190) {
+				Wood[i].x = 6.9;
+				Wood[i].y = -2.5+(i-177)*0.2;
+			}
+
+			// Top
+			else if(i<216) {
+				Wood[i].x = 5.9+(i-190)*0.2;
+				Wood[i].y = 0;
+			}
+            else if(i<242) {
+				Wood[i].x = 5.9+(i-216)*0.2;
+				Wood[i].y = 0;
+			}
+			else if(i<264) {
+				Wood[i].x = 6.3+(i-242)*0.2;
+				Wood[i].y = 0.2;
+			}
+            else if(i<282) {
+				Wood[i].x = 6.7+(i-264)*0.2;
+				Wood[i].y = 0.4;
+			}
+
+			// Tower
+			else if(i<292) {
+				Wood[i].x = 1.7;
+				Wood[i].y = -2.9+(i-282)*0.2;
+			}
+			else if(i<302) {
+				Wood[i].x = 2.3;
+				Wood[i].y = -2.9+(i-292)*0.2;
+			}
+			else if(i<308) {
+				Wood[i].x = 1.5+(i-302)*0.2;
+				Wood[i].y = -1;
+			}
+
+			Wood[i].radius = 0.2;
+			Wood[i].Vel = glm::vec2(0, 0);
+			Wood[i].px = Wood[i].x;
+			Wood[i].py = Wood[i].y;
+			Wood[i].sleeping = 0;
+			Wood[i].still = 0;
+			Wood[i].island = -1;
+			Wood[i].alive = 1;
+			setMaterial(Wood[i], MAT_WOOD);
+		}
+	}
+}
+
+void World::createCannon()
+{
+	Cannon.x = -3.5;
+	Cannon.y = -2.7;
+	Cannon.angle = 0;
+	Cannon.power = 0;
+}
+
+// Puts the level back to its starting state
+void World::reset()
+{
+	enemies_left = ENEMY_NUMBER;
+	Player1.lives = 5;
+	Player1.score = 0;
+	Player1.game_over = 0;
+	bird_count = 0;
+	createEnemies();
+	createWood();
+	// Bodies fills in as bodies wake, but no body may start out doomed
+	memset(Bodies.flags, 0, sizeof(Bodies.flags));
+	Sleep.wood_dirty = true;
+}
+
+// Fires a bird at angle degrees with the given power, clamped as the controls are
+void World::shoot(float angle, float power)
+{
+	Cannon.angle = max(-90.0f, min(90.0f, angle));
+	Cannon.power = max(0.0f, min((float)MAX_POWER, power));
+	fire_bird();
+	Cannon.power = 0;
+}
+
+/**
+   Flat observation of OBS_SIZE floats: enemies left, birds fired and
+   score, then (x, y, alive) for every body id in BodyStore order. Slots
+   with no body in them are zero.
+*/
+void World::observe(float *out)
+{
+	out[0] = enemies_left;
+	out[1] = bird_count;
+	out[2] = Player1.score;
+	memset(out+3, 0, 3*MAX_BODIES*sizeof(float));
+	for (int id=0; id<WOOD_BASE+WOOD_NUMBER; id++) {
+		if (id >= BIRD_BASE+bird_count && id < ENEMY_BASE)
+			continue;
+		if (id >= ENEMY_BASE+ENEMY_NUMBER && id < WOOD_BASE)
+			continue;
+		Character& C = body(id);
+		out[3+3*id] = C.x;
+		out[3+3*id+1] = C.y;
+		out[3+3*id+2] = C.alive;
+	}
+}
+
+/* The game on screen is played in Main. These names keep the input and
+   rendering code pointed at it */
+World Main;
+Character (&Wood)[MAX_WOOD] = Main.Wood;
+Character (&Enemies)[MAX_ENEMY] = Main.Enemies;
+Character (&Bird)[MAX_BIRD] = Main.Bird;
+int& bird_count = Main.bird_count;
+int& enemies_left = Main.enemies_left;
+Wall& Floor = Main.Floor;
+Wall& CWall = Main.CWall;
+Weapon& Cannon = Main.Cannon;
+Player& Player1 = Main.Player1;
+
+// Puts the camera back where a level starts
+void resetView()
+{
+	Game.x = 3.6;
+	Game.y = 0;
+	Game.z = 3;
+}
+
+void resetGame()
+{
+	resetView();
+	Main.reset();
+}
+
+/* One tick of the game on screen, which restarts once it is cleared */
+void step() {
+	Main.step();
+	if(!enemies_left)
+		resetGame();
+}
+
+struct Action {
+	float angle, power;
+	int ticks;	// ticks to run after the shot
+};
+
+/**
+   Batch of independent worlds for training. The worlds sit in one
+   vector, and reset(), step() and observe() each cover the whole batch
+   in one call, one pool job per world. Inside the batch every world
+   detects on Serial, so the pool is never entered twice.
+*/
+class BatchEnv {
+public:
+	vector<World> worlds;
+
+	void start(int n) {
+		worlds.assign(max(1, n), World());
+		for (size_t k=0; k<worlds.size(); k++)
+			worlds[k].pool = &Serial;
+	}
+
+	// Resets world k wherever mask[k] is set
+	void reset(const vector<char>& mask) {
+		Pool.run(worlds.size(), [&](int k, int t) {
+			if (mask[k])
+				worlds[k].reset();
+		});
+	}
+
+	/* Fires actions[k] in world k and runs its ticks. reward[k] is the
+	   score gained and done[k] is set once world k has no enemies or no
+	   shots left; a world stops ticking as soon as it is cleared, and
+	   ticked[k] is how many ticks it ran */
+	void step(const vector<Action>& actions, vector<float>& reward, vector<char>& done, vector<int>& ticked) {
+		reward.assign(worlds.size(), 0);
+		done.assign(worlds.size(), 0);
+		ticked.assign(worlds.size(), 0);
+		Pool.run(worlds.size(), [&](int k, int t) {
+			World& W = worlds[k];
+			int score = W.Player1.score;
+			W.shoot(actions[k].angle, actions[k].power);
+			for (; ticked[k]<actions[k].ticks && W.enemies_left; ticked[k]++)
+				W.step();
+			reward[k] = W.Player1.score - score;
+			done[k] = !W.enemies_left || W.bird_count >= MAX_SHOTS;
+		});
+	}
+
+	// Writes OBS_SIZE floats per world, world after world
+	void observe(vector<float>& out) {
+		out.resize(worlds.size()*OBS_SIZE);
+		Pool.run(worlds.size(), [&](int k, int t) {
+			worlds[k].observe(&out[k*OBS_SIZE]);
+		});
+	}
+};
+
+/* Benchmarks a batch of n worlds, sweeping the shot angle over the batch
+   and the power over the rounds, and reports the throughput */
+int runBatch (int n, int ticks, int shot_ticks)
+{
+	BatchEnv Batch;
+	Batch.start(n);
+	vector<Action> actions(Batch.worlds.size());
+	vector<float> reward, obs;
+	vector<char> done;
+	vector<int> left(Batch.worlds.size()), ticked;
+	int rounds = max(1, ticks/shot_ticks);
+	long shots = 0, kills = 0, stepped = 0;
+
+	chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+	for (int r=0; r<rounds; r++) {
+		for (size_t k=0; k<actions.size(); k++) {
+			actions[k].angle = 60.0f*k/actions.size();
+			actions[k].power = MAX_POWER*(0.5f + 0.5f*(r%4)/3);
+			actions[k].ticks = shot_ticks;
+			left[k] = Batch.worlds[k].enemies_left;
+		}
+		Batch.step(actions, reward, done, ticked);
+		// The score counts wood too, so kills are counted off enemies_left
+		for (size_t k=0; k<left.size(); k++) {
+			kills += left[k] - Batch.worlds[k].enemies_left;
+			stepped += ticked[k];
+		}
+		Batch.observe(obs);
+		Batch.reset(done);
+		shots += actions.size();
+	}
+	double elapsed = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+	elapsed = max(elapsed, 1e-9);
+
+	cout << "WORLDS: " << Batch.worlds.size() << endl;
+	cout << "SHOTS: " << shots << " in " << elapsed << "s (" << shots/elapsed*3600 << " shots/h)" << endl;
+	cout << "TICKS: " << stepped/elapsed << " ticks/s" << endl;
+	cout << "KILLS: " << kills << endl;
+	return EXIT_SUCCESS;
+}
+
+struct Shot {
+	float angle, power;
+	int kills, score, ticks;
+};
+
+// More kills first, then more score, then the quicker shot
+bool betterShot(const Shot& a, const Shot& b)
+{
+	if (a.kills != b.kills)
+		return a.kills > b.kills;
+	if (a.score != b.score)
+		return a.score > b.score;
+	return a.ticks < b.ticks;
+}
+
+/* Replays s in W from a copy of base for at most budget ticks. The run
+   ends early once the bird has been still for SLEEP_TICKS ticks, as it
+   can kill nothing more, or once every enemy is dead */
+void playShot(const World& base, World& W, Shot& s, int budget)
+{
+	W = base;
+	W.pool = &Serial;
+	W.shoot(s.angle, s.power);
+	Character& B = W.Bird[W.bird_count-1];
+	s.ticks = 0;
+	while (s.ticks < budget && W.enemies_left && B.still < SLEEP_TICKS) {
+		W.step();
+		s.ticks++;
+	}
+	s.kills = base.enemies_left - W.enemies_left;
+	s.score = W.Player1.score - base.Player1.score;
+}
+
+/**
+   Searches (angle, power) for the shot that kills the most enemies in
+   the level. A grid x grid sweep over every angle and power the controls
+   allow is followed by REFINE_ROUNDS sweeps, each at half the spacing of
+   the last, around the best REFINE_KEEP shots so far. Candidates are
+   spread over the pool, one per job.
+*/
+#define REFINE_ROUNDS 3
+#define REFINE_KEEP 4
+
+int runSolve (int grid, int budget)
+{
+	World base = Main;
+	vector<World> worlds(Pool.threads, base);
+	vector<Shot> tried, next;
+
+	auto play = [&]() {
+		Pool.run(next.size(), [&](int k, int t) {
+			playShot(base, worlds[t], next[k], budget);
+		});
+		tried.insert(tried.end(), next.begin(), next.end());
+		stable_sort(tried.begin(), tried.end(), betterShot);
+		next.clear();
+	};
+
+	chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+	grid = max(2, grid);
+	float da = 180.0f/(grid-1), dp = MAX_POWER/grid;
+	for (int i=0; i<grid; i++)
+		for (int j=1; j<=grid; j++) {
+			Shot s = {-90 + i*da, j*dp, 0, 0, 0};
+			next.push_back(s);
+		}
+	play();
+
+	for (int r=1; r<=REFINE_ROUNDS; r++) {
+		da /= 2;
+		dp /= 2;
+		int keep = min((int)tried.size(), REFINE_KEEP);
+		for (int k=0; k<keep; k++)
+			for (int i=-1; i<=1; i++)
+				for (int j=-1; j<=1; j++) {
+					if (!i && !j)
+						continue;
+					Shot s = tried[k];
+					s.angle = clamp(s.angle + i*da, -90, 90);
+					s.power = clamp(s.power + j*dp, 0, MAX_POWER);
+					next.push_back(s);
+				}
+		play();
+	}
+	double elapsed = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+	const Shot& best = tried[0];
+	cout << "CANDIDATES: " << tried.size() << " in " << elapsed << "s" << endl;
+	cout << "BEST: angle " << best.angle << " power " << best.power << endl;
+	cout << "KILLS: " << best.kills << " of " << base.enemies_left << endl;
+	cout << "SCORE: " << best.score << " in " << best.ticks << " ticks" << endl;
+	return EXIT_SUCCESS;
+}
+
+/**
+   Regression check for the swept tests. Plays one shot at every
+   CHECK_ANGLE_STEP degrees up to 90, at each power in the list, and
+   fails if a bird or enemy moving faster than its radius stays where it
+   is for more than one tick: a swept test holding it short of a contact
+   the discrete tests never meet.
+*/
+#define CHECK_ANGLE_STEP 0.5
+#define CHECK_TICKS 600
+
+int runCheck ()
+{
+	const float powers[] = {1.4, 1.55, 1.7, 1.85, 2.0, 2.15};
+	const int n_powers = sizeof(powers)/sizeof(powers[0]);
+	const int n_angles = 90/CHECK_ANGLE_STEP + 1;
+	World base = Main;
+	vector<World> worlds(Pool.threads, base);
+	vector<int> held(n_angles*n_powers), who(held.size());
+
+	Pool.run(held.size(), [&](int k, int t) {
+		World& W = worlds[t];
+		W = base;
+		W.pool = &Serial;
+		W.shoot(k/n_powers*CHECK_ANGLE_STEP, powers[k%n_powers]);
+		int still[WOOD_BASE] = {0};
+		for (int n=0; n<CHECK_TICKS; n++) {
+			W.step();
+			for (int id=0; id<WOOD_BASE; id++) {
+				if (id >= BIRD_BASE+W.bird_count && id < ENEMY_BASE)
+					continue;
+				Character& C = W.body(id);
+				float moved = glm::length(glm::vec2(C.x - C.px, C.y - C.py));
+				if (C.alive && !C.sleeping && glm::length(C.Vel) > C.radius && moved < SWEEP_SKIN)
+					still[id]++;
+				else
+					still[id] = 0;
+				if (still[id] > held[k]) {
+					held[k] = still[id];
+					who[k] = id;
+				}
+			}
+		}
+	});
+
+	int failed = 0;
+	for (size_t k=0; k<held.size(); k++)
+		if (held[k] > 1) {
+			cout << "HELD: angle " << k/n_powers*CHECK_ANGLE_STEP << " power " << powers[k%n_powers];
+			cout << " body " << who[k] << " for " << held[k] << " ticks" << endl;
+			failed++;
+		}
+	cout << "CHECK: " << failed << " of " << held.size() << " shots held a body" << endl;
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Step the simulation flat out without a window. The queued shots
+   (angle, power) are fired one every shot_ticks ticks */
+int runHeadless (int ticks, const vector<glm::vec2>& shots, int shot_ticks)
+{
+	chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+	for (int t=0; t<ticks; t++) {
+		size_t shot = t/shot_ticks;
+		if (t%shot_ticks == 0 && shot < shots.size())
+			Main.shoot(shots[shot].x, shots[shot].y);
+		step();
+	}
+	double elapsed = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+	cout << "TICKS: " << ticks << " in " << elapsed << "s (" << ticks/max(elapsed, 1e-9) << " ticks/s)" << endl;
+	cout << "SCORE: " << Player1.score << endl;
+	cout << "ENEMIES LEFT: " << enemies_left << endl;
+	return EXIT_SUCCESS;
+}
+
+#ifndef HEADLESS
+
+//####################################################################################################
+
+/* Function to load Shaders - Use it as it is */
+GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path) {
+
+	// Create the shaders
+	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
+	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+
+	// Read the Vertex Shader code from the file
+	std::string VertexShaderCode;
+	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
+	if(VertexShaderStream.is_open())
+	{
+		std::string Line = "";
+		while(getline(VertexShaderStream, Line))
+			VertexShaderCode += "\n" + Line;
+		VertexShaderStream.close();
+	}
+
+	// Read the Fragment Shader code from the file
+	std::string FragmentShaderCode;
+	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
+	if(FragmentShaderStream.is_open()){
+		std::string Line = "";
+		while(getline(FragmentShaderStream, Line))
+			FragmentShaderCode += "\n" + Line;
+		FragmentShaderStream.close();
+	}
+
+	GLint Result = GL_FALSE;
+	int InfoLogLength;
+
+	// Compile Vertex Shader
+	printf("Compiling shader : %s\n", vertex_file_path);
+	char const * VertexSourcePointer = VertexShaderCode.c_str();
+	glShaderSource(VertexShaderID, 1, &VertexSourcePointer , NULL);
+	glCompileShader(VertexShaderID);
+
+	// Check Vertex Shader
+	glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
+	glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	std::vector<char> VertexShaderErrorMessage(InfoLogLength);
+	glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
+	fprintf(stdout, "%s\n", &VertexShaderErrorMessage[0]);
+
+	// Compile Fragment Shader
+	printf("Compiling shader : %s\n", fragment_file_path);
+	char const * FragmentSourcePointer = FragmentShaderCode.c_str();
+	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , NULL);
+	glCompileShader(FragmentShaderID);
+
+	// Check Fragment Shader
+	glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
+	glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	std::vector<char> FragmentShaderErrorMessage(InfoLogLength);
+	glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
+	fprintf(stdout, "%s\n", &FragmentShaderErrorMessage[0]);
+
+	// Link the program
+	fprintf(stdout, "Linking program\n");
+	GLuint ProgramID = glCreateProgram();
+	glAttachShader(ProgramID, VertexShaderID);
+	glAttachShader(ProgramID, FragmentShaderID);
+	glLinkProgram(ProgramID);
+
+	// Check the program
+	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+	glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	std::vector<char> ProgramErrorMessage( max(InfoLogLength, int(1)) );
+	glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
+	fprintf(stdout, "%s\n", &ProgramErrorMessage[0]);
+
+	glDeleteShader(VertexShaderID);
+	glDeleteShader(FragmentShaderID);
+
+	return ProgramID;
+}
+
+static void error_callback(int error, const char* description)
+{
+	fprintf(stderr, "Error: %s\n", description);
+}
+
+void releaseBodySprites ();
+void reportTimings ();
+void stopSimulation ();
+
+void quit(GLFWwindow *window)
+{
+	stopSimulation();
+	reportTimings();
+	releaseBodySprites();
+	glfwDestroyWindow(window);
+	glfwTerminate();
+	exit(EXIT_SUCCESS);
+}
+
+/* Generate VAO and its interleaved VBO and return VAO handle. The
+   attribute layout is recorded in the VAO, so drawing only binds it */
+struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const Vertex* vertices, GLenum fill_mode=GL_FILL)
+{
+	struct VAO* vao = new struct VAO;
+	vao->PrimitiveMode = primitive_mode;
+	vao->NumVertices = numVertices;
+	vao->FillMode = fill_mode;
+	vao->shader = NULL;
+	vao->coarser = NULL;
 
 	// Create Vertex Array Object
 	// Should be done after CreateWindow and before any other GL calls
 	glGenVertexArrays(1, &(vao->VertexArrayID)); // VAO
-	glGenBuffers (1, &(vao->VertexBuffer)); // VBO - vertices
-	glGenBuffers (1, &(vao->ColorBuffer));  // VBO - colors
+	glGenBuffers (1, &(vao->VertexBuffer)); // VBO - vertices and colors
 
 	glBindVertexArray (vao->VertexArrayID); // Bind the VAO
-	glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer); // Bind the VBO vertices
-	glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), vertex_buffer_data, GL_STATIC_DRAW); // Copy the vertices into VBO
+	glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer); // Bind the VBO
+	glBufferData (GL_ARRAY_BUFFER, numVertices*sizeof(Vertex), vertices, GL_STATIC_DRAW); // Copy the vertices into VBO
+	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(
 		0,                  // attribute 0. Vertices
 		3,                  // size (x,y,z)
 		GL_FLOAT,           // type
 		GL_FALSE,           // normalized?
-		0,                  // stride
+		sizeof(Vertex),     // stride
 		(void*)0            // array buffer offset
 		);
-
-	glBindBuffer (GL_ARRAY_BUFFER, vao->ColorBuffer); // Bind the VBO colors
-	glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), color_buffer_data, GL_STATIC_DRAW);  // Copy the vertex colors
+	glEnableVertexAttribArray(1);
 	glVertexAttribPointer(
 		1,                  // attribute 1. Color
-		3,                  // size (r,g,b)
-		GL_FLOAT,           // type
-		GL_FALSE,           // normalized?
-		0,                  // stride
-		(void*)0            // array buffer offset
+		4,                  // size (r,g,b,a)
+		GL_UNSIGNED_BYTE,   // type
+		GL_TRUE,            // normalized? 0..255 to 0..1
+		sizeof(Vertex),     // stride
+		(void*)(3*sizeof(GLfloat)) // array buffer offset
 		);
 
 	return vao;
 }
 
-VAO * createRectangle (float r1,float g1,float b1,float r2,float g2,float b2,float x1,float y1,float x2,float y2,float x3,float y3,float x4,float y4)
+GLubyte packColor (GLfloat c)
+{
+	return (GLubyte)(clamp(c, 0, 1)*255 + 0.5f);
+}
+
+/* Generate VAO, VBOs and return VAO handle - from separate xyz and rgb arrays */
+struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL)
+{
+	vector<Vertex> vertices(numVertices);
+	for (int i=0; i<numVertices; i++) {
+		vertices[i].x = vertex_buffer_data[3*i];
+		vertices[i].y = vertex_buffer_data[3*i + 1];
+		vertices[i].z = vertex_buffer_data[3*i + 2];
+		vertices[i].r = packColor(color_buffer_data[3*i]);
+		vertices[i].g = packColor(color_buffer_data[3*i + 1]);
+		vertices[i].b = packColor(color_buffer_data[3*i + 2]);
+		vertices[i].a = 255;
+	}
+	return create3DObject(primitive_mode, numVertices, &vertices[0], fill_mode);
+}
+
+VAO * createRectangle (float r1,float g1,float b1,float r2,float g2,float b2,float x1,float y1,float x2,float y2,float x3,float y3,float x4,float y4)
+{
+	VAO * rectangle;
+	GLfloat vertex_buffer_data [] = { x1,y1,0, x2,y2,0 , x3,y3,0, x4,y4,0, x3,y3,0 , x2,y2,0};
+	GLfloat color_buffer_data [] = {  r1,g1,b1, r1,g1,b1, r2,g2,b2,  r2,g2,b2, r2,g2,b2, r1,g1,b1}; // 1 , 2 , 3 , 4 , 3, 2
+	rectangle = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
+	return rectangle;
+}
+
+void createSevenSeg()
+{
+	sevenseg[0]=createRectangle(0.0,0.0,0.0,0.0,0.0,0.0, 0.0f/3,0.0f/3, 0.8f/3,0.0f/3 , 0.1f/3,0.1f/3, 0.7f/3,0.1f/3);
+	sevenseg[1]=createRectangle(0.0,0.0,0.0,0.0,0.0,0.0, 0.0f/3,0.1f/3, 0.1f/3,0.2f/3 , 0.0f/3,.9f/3, 0.1f/3,0.8f/3);
+	sevenseg[2]=createRectangle(0.0,0.0,0.0,0.0,0.0,0.0, 0.0f/3,1.0f/3, 0.1f/3,1.1f/3 , 0.0f/3,1.8f/3, 0.1f/3,1.7f/3);
+	sevenseg[3]=createRectangle(0.0,0.0,0.0,0.0,0.0,0.0, 0.1f/3,1.8f/3, 0.7f/3,1.8f/3 , 0.0f/3,1.9f/3, 0.8f/3,1.9f/3);
+	sevenseg[4]=createRectangle(0.0,0.0,0.0,0.0,0.0,0.0, 0.7f/3,1.1f/3, 0.8f/3,1.0f/3 , 0.7f/3,1.7f/3, 0.8f/3,1.8f/3);
+	sevenseg[5]=createRectangle(0.0,0.0,0.0,0.0,0.0,0.0, 0.7f/3,0.2f/3, 0.8f/3,0.1f/3 , 0.7f/3,0.8f/3, 0.8f/3,0.9f/3);
+	sevenseg[6]=createRectangle(0.0,0.0,0.0,0.0,0.0,0.0, 0.1f/3,0.95f/3, 0.7f/3,0.95f/3 , 0.2f/3,1.0f/3, 0.6f/3,1.0f/3);
+	sevenseg[7]=createRectangle(0.0,0.0,0.0,0.0,0.0,0.0, 0.2f/3,0.9f/3, 0.6f/3,0.9f/3 , 0.1f/3,0.95f/3, 0.7f/3,0.95f/3);
+
+
+	for(int i=0;i<6;i++)
+		sevensegdecoder[0].push_back(i);
+	sevensegdecoder[1].push_back(4);
+	sevensegdecoder[1].push_back(5);
+
+	sevensegdecoder[2].push_back(3);
+	sevensegdecoder[2].push_back(4);
+	sevensegdecoder[2].push_back(6);
+	sevensegdecoder[2].push_back(7);
+	sevensegdecoder[2].push_back(1);
+	sevensegdecoder[2].push_back(0);
+
+	sevensegdecoder[3].push_back(3);
+	sevensegdecoder[3].push_back(4);
+	sevensegdecoder[3].push_back(6);
+	sevensegdecoder[3].push_back(7);
+	sevensegdecoder[3].push_back(5);
+	sevensegdecoder[3].push_back(0);
+
+	sevensegdecoder[4].push_back(2);
+	sevensegdecoder[4].push_back(6);
+	sevensegdecoder[4].push_back(7);
+	sevensegdecoder[4].push_back(4);
+	sevensegdecoder[4].push_back(5);
+
+
+	sevensegdecoder[5].push_back(3);
+	sevensegdecoder[5].push_back(2);
+	sevensegdecoder[5].push_back(6);
+	sevensegdecoder[5].push_back(7);
+	sevensegdecoder[5].push_back(5);
+	sevensegdecoder[5].push_back(0);
+
+
+	sevensegdecoder[6].push_back(3);
+	sevensegdecoder[6].push_back(2);
+	sevensegdecoder[6].push_back(6);
+	sevensegdecoder[6].push_back(7);
+	sevensegdecoder[6].push_back(5);
+	sevensegdecoder[6].push_back(1);
+	sevensegdecoder[6].push_back(0);
+
+
+	sevensegdecoder[7].push_back(3);
+	sevensegdecoder[7].push_back(4);
+	sevensegdecoder[7].push_back(5);
+
+	for(int i=0;i<8;i++)
+		sevensegdecoder[8].push_back(i);
+
+	sevensegdecoder[9].push_back(2);
+	sevensegdecoder[9].push_back(3);
+	sevensegdecoder[9].push_back(4);
+	sevensegdecoder[9].push_back(6);
+	sevensegdecoder[9].push_back(7);
+	sevensegdecoder[9].push_back(5);
+
+}
+
+/* Generate VAO, VBOs and return VAO handle - Common Color for all vertices */
+struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat red, const GLfloat green, const GLfloat blue, GLenum fill_mode=GL_FILL)
+{
+	GLfloat* color_buffer_data = new GLfloat [3*numVertices];
+	for (int i=0; i<numVertices; i++) {
+		color_buffer_data [3*i] = red;
+		color_buffer_data [3*i + 1] = green;
+		color_buffer_data [3*i + 2] = blue;
+	}
+
+	struct VAO* vao = create3DObject(primitive_mode, numVertices, vertex_buffer_data, color_buffer_data, fill_mode);
+	delete [] color_buffer_data;	// glBufferData has its own copy
+	return vao;
+}
+
+/**
+   GL state tracker. Remembers the program, fill mode, blending and VAO last set
+   and drops calls that would set them to what they already are. reset()
+   forgets everything, for the start of a frame or after GL calls made
+   behind its back.
+*/
+class GLState {
+public:
+	GLuint program;
+	GLenum fill;
+	GLuint vao;
+	bool blending;
+	bool known;
+
+	void reset() {
+		known = false;
+	}
+
+	void useProgram(GLuint p) {
+		if (known && p == program)
+			return;
+		if (!known) {
+			fill = GL_FILL;
+			glPolygonMode (GL_FRONT_AND_BACK, fill);
+			vao = 0;
+			glBindVertexArray (vao);
+			blending = false;
+			glDisable (GL_BLEND);
+			known = true;
+		}
+		glUseProgram (p);
+		program = p;
+	}
+
+	void polygonMode(GLenum mode) {
+		if (mode == fill)
+			return;
+		glPolygonMode (GL_FRONT_AND_BACK, mode);
+		fill = mode;
+	}
+
+	void blend(bool on) {
+		if (on == blending)
+			return;
+		if (on)
+			glEnable (GL_BLEND);
+		else
+			glDisable (GL_BLEND);
+		blending = on;
+	}
+
+	void bindVertexArray(GLuint id) {
+		if (id == vao)
+			return;
+		glBindVertexArray (id);
+		vao = id;
+	}
+} State;
+
+/* Render the VBOs handled by VAO */
+void draw3DObject (struct VAO* vao)
+{
+	// Change the Fill Mode for this object
+	State.polygonMode(vao->FillMode);
+
+	// Bind the VAO to use, it carries the vertex layout and buffer
+	State.bindVertexArray(vao->VertexArrayID);
+
+	// Draw the geometry !
+	glDrawArrays(vao->PrimitiveMode, 0, vao->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
+}
+
+/**
+   Render queue. draw() pushes its draws and flush() submits them sorted
+   by (layer, program, fill mode, VAO), so each run of draws sharing state
+   costs one set of state changes. Everything sits at z = 0 and the depth
+   test is GL_LEQUAL, so a later draw covers an earlier one: layers keep
+   that painter's order between groups, and the sort only regroups draws
+   inside a layer. The sort is stable, so equal keys keep their order.
+*/
+enum draw_layer {
+	LAYER_SUN, LAYER_WALL, LAYER_CANNON, LAYER_BIRDS, LAYER_BARREL, LAYER_POWER, LAYER_ENEMIES,
+	LAYER_WOOD, LAYER_HUD
+};
+
+struct DrawItem {
+	unsigned long long key;
+	VAO *vao;
+	GLuint program;
+	GLint matrix;	// MVP uniform of program
+	bool blend;
+	glm::mat4 MVP;
+};
+
+bool drawBefore(const DrawItem& a, const DrawItem& b) {
+	return a.key < b.key;
+}
+
+class RenderQueue {
+public:
+	vector<DrawItem> items;
+
+	void push(int layer, VAO *vao, const glm::mat4& MVP) {
+		DrawItem d;
+		d.vao = vao;
+		d.program = vao->shader ? vao->shader->ProgramID : programID;
+		d.matrix = vao->shader ? vao->shader->MatrixID : Matrices.MatrixID;
+		d.blend = vao->shader && vao->shader->blend;
+		d.MVP = MVP;
+		d.key = (unsigned long long)layer << 48
+			| (unsigned long long)(d.program & 0xffff) << 32
+			| (unsigned long long)(vao->FillMode != GL_FILL) << 31
+			| (vao->VertexArrayID & 0x7fffffff);
+		items.push_back(d);
+	}
+
+	void flush() {
+		stable_sort(items.begin(), items.end(), drawBefore);
+		for (size_t k=0; k<items.size(); k++) {
+			State.useProgram(items[k].program);
+			State.blend(items[k].blend);
+			glUniformMatrix4fv(items[k].matrix, 1, GL_FALSE, &items[k].MVP[0][0]);
+			draw3DObject(items[k].vao);
+		}
+		items.clear();
+	}
+} Queue;
+
+/**
+   View culling. The camera is an ortho projection, so what it sees is a
+   rectangle in world space, found by taking the corners of clip space
+   back through inverse(VP). draw() works it out once a frame and skips
+   everything outside it. With culling off the rectangle covers everything.
+*/
+bool culling = true;
+
+struct ViewBox {
+	float x1, y1, x2, y2;
+
+	// Whether a box of half size (rx, ry) at (x, y) is in view
+	bool sees(float x, float y, float rx, float ry) const {
+		return x+rx >= x1 && x-rx <= x2 && y+ry >= y1 && y-ry <= y2;
+	}
+} Visible;
+
+ViewBox viewBox (const glm::mat4& VP)
+{
+	ViewBox V;
+	if (!culling) {
+		V.x1 = V.y1 = -1e30;
+		V.x2 = V.y2 = 1e30;
+		return V;
+	}
+	glm::mat4 inv = glm::inverse(VP);
+	V.x1 = V.y1 = 1e30;
+	V.x2 = V.y2 = -1e30;
+	for (int i=0; i<4; i++) {
+		glm::vec4 corner = inv * glm::vec4(i&1 ? 1 : -1, i&2 ? 1 : -1, 0, 1);
+		V.x1 = min(V.x1, corner.x/corner.w);
+		V.x2 = max(V.x2, corner.x/corner.w);
+		V.y1 = min(V.y1, corner.y/corner.w);
+		V.y2 = max(V.y2, corner.y/corner.w);
+	}
+	return V;
+}
+
+/* Delete the VAO and its VBOs */
+void destroy3DObject (struct VAO* vao)
+{
+	glDeleteBuffers (1, &(vao->VertexBuffer));
+	glDeleteVertexArrays (1, &(vao->VertexArrayID));
+	if (vao->coarser)
+		destroy3DObject(vao->coarser);
+	delete vao;
+}
+
+/**
+   Shared meshes. Bodies that look alike draw the same VAO: acquire()
+   builds the mesh the first time its key is asked for and hands out the
+   same handle after that, counting references, and release() deletes
+   the VAO and its buffers along with the last reference.
+*/
+class MeshCache {
+public:
+	struct Entry {
+		VAO *vao;
+		int refs;
+	};
+	map<string, Entry> meshes;
+
+	VAO* acquire(const string& key, const function<VAO*()>& build) {
+		Entry& e = meshes[key];
+		if (!e.refs)
+			e.vao = build();
+		e.refs++;
+		return e.vao;
+	}
+
+	void release(VAO *vao) {
+		for (map<string, Entry>::iterator it=meshes.begin(); it!=meshes.end(); ++it) {
+			if (it->second.vao != vao)
+				continue;
+			if (--it->second.refs == 0) {
+				destroy3DObject(vao);
+				meshes.erase(it);
+			}
+			return;
+		}
+	}
+} Meshes;
+
+/**
+   Frame timings. Profile times the passes of draw() on the GPU with
+   GL_TIME_ELAPSED queries and main's loop on the CPU with steady_clock,
+   keeping the last TIMING_SAMPLES frames of each for min, average and
+   99th percentile. Every pass has a ring of QUERY_RING queries, so a
+   result is read back QUERY_RING frames after it was issued; if the GPU
+   still hasn't finished it the sample is dropped rather than waited on.
+   F3 shows the timings as bars, --profile prints them on exit.
+*/
+#define TIMING_SAMPLES 240
+#define QUERY_RING 4
+#define FRAME_BUDGET_MS 16.7	// a bar spans half the screen at this
+
+class TimingSeries {
+public:
+	const char *name;
+	vector<double> samples;	// milliseconds, used as a ring once full
+	size_t next;
+
+	void add(double ms) {
+		if (samples.size() < TIMING_SAMPLES)
+			samples.push_back(ms);
+		else
+			samples[next] = ms;
+		next = (next+1) % TIMING_SAMPLES;
+	}
+
+	double minimum() const {
+		return samples.empty() ? 0 : *min_element(samples.begin(), samples.end());
+	}
+
+	double average() const {
+		double sum = 0;
+		for (size_t i=0; i<samples.size(); i++)
+			sum += samples[i];
+		return samples.empty() ? 0 : sum/samples.size();
+	}
+
+	double p99() const {
+		if (samples.empty())
+			return 0;
+		vector<double> sorted(samples);
+		size_t k = (sorted.size()-1)*99/100;
+		nth_element(sorted.begin(), sorted.begin()+k, sorted.end());
+		return sorted[k];
+	}
+};
+
+enum gpu_pass { PASS_BACKGROUND, PASS_WORLD, PASS_HUD, GPU_PASSES };
+enum cpu_task { TASK_PHYSICS, TASK_DRAW, TASK_SWAP, TASK_POLL, CPU_TASKS };
+
+class Profiler {
+public:
+	bool enabled;	// collecting timings
+	bool overlay;	// drawing them
+	int frame;
+	GLuint queries[GPU_PASSES][QUERY_RING];
+	bool issued[GPU_PASSES][QUERY_RING];
+	TimingSeries gpu[GPU_PASSES];
+	TimingSeries cpu[CPU_TASKS];
+	chrono::steady_clock::time_point started[CPU_TASKS];
+	double seen_ms;	// physics thread totals at the last snapshot read
+	long seen_advances;
+	VAO *gpuBar, *cpuBar, *mark;
+
+	Profiler() : enabled(false), overlay(false), frame(0), seen_ms(0), seen_advances(0) {
+		const char *gpu_names[GPU_PASSES] = {"gpu background", "gpu world", "gpu hud"};
+		const char *cpu_names[CPU_TASKS] = {"cpu physics", "cpu draw", "cpu swap", "cpu poll"};
+		for (int p=0; p<GPU_PASSES; p++)
+			gpu[p].name = gpu_names[p], gpu[p].next = 0;
+		for (int t=0; t<CPU_TASKS; t++)
+			cpu[t].name = cpu_names[t], cpu[t].next = 0;
+	}
+
+	void create() {
+		glGenQueries(GPU_PASSES*QUERY_RING, &queries[0][0]);
+		for (int p=0; p<GPU_PASSES; p++)
+			for (int i=0; i<QUERY_RING; i++)
+				issued[p][i] = false;
+
+		// Unit squares, stretched to length when drawn
+		static const GLfloat vertex_buffer_data [] = {
+			0,0,0, 1,0,0, 1,1,0,
+			1,1,0, 0,1,0, 0,0,0
+		};
+		gpuBar = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, 1, 0.5, 0, GL_FILL);
+		cpuBar = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, 0, 0.4, 1, GL_FILL);
+		mark = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, 0, 0, 0, GL_FILL);
+	}
+
+	// Reads the query in slot of pass if the GPU has finished with it
+	void collect(int pass, int slot) {
+		if (!issued[pass][slot])
+			return;
+		issued[pass][slot] = false;
+		GLint ready = 0;
+		glGetQueryObjectiv(queries[pass][slot], GL_QUERY_RESULT_AVAILABLE, &ready);
+		if (!ready)
+			return;
+		GLuint64 ns;
+		glGetQueryObjectui64v(queries[pass][slot], GL_QUERY_RESULT, &ns);
+		gpu[pass].add(ns/1e6);
+	}
+
+	void beginPass(int pass) {
+		if (!enabled)
+			return;
+		int slot = frame % QUERY_RING;
+		collect(pass, slot);
+		glBeginQuery(GL_TIME_ELAPSED, queries[pass][slot]);
+	}
+
+	void endPass(int pass) {
+		if (!enabled)
+			return;
+		glEndQuery(GL_TIME_ELAPSED);
+		issued[pass][frame % QUERY_RING] = true;
+	}
+
+	void start(int task) {
+		started[task] = chrono::steady_clock::now();
+	}
+
+	void stop(int task) {
+		if (enabled)
+			cpu[task].add(chrono::duration<double, milli>(chrono::steady_clock::now() - started[task]).count());
+	}
+
+	/* Physics ticked on its own thread, from the running totals in the
+	   latest snapshot: one TASK_PHYSICS sample of the average advance()
+	   since the last snapshot this thread read */
+	void addPhysics(double total_ms, long advances) {
+		if (enabled && advances > seen_advances)
+			cpu[TASK_PHYSICS].add((total_ms - seen_ms)/(advances - seen_advances));
+		seen_ms = total_ms;
+		seen_advances = advances;
+	}
+
+	void endFrame() {
+		frame++;
+	}
+
+	void report(ostream& out) const {
+		out << "TIMINGS (ms over the last " << TIMING_SAMPLES << " frames): min avg p99" << endl;
+		for (int p=0; p<GPU_PASSES; p++)
+			reportSeries(out, gpu[p]);
+		for (int t=0; t<CPU_TASKS; t++)
+			reportSeries(out, cpu[t]);
+	}
+
+	void reportSeries(ostream& out, const TimingSeries& T) const {
+		if (T.samples.empty())
+			return;
+		out << T.name << ": " << T.minimum() << " " << T.average() << " " << T.p99() << endl;
+	}
+
+	// Bar of each average with a mark at its p99, top left of the screen
+	void queueOverlay() {
+		if (!overlay)
+			return;
+		int row = 0;
+		for (int p=0; p<GPU_PASSES; p++)
+			queueBar(gpuBar, gpu[p], row++);
+		for (int t=0; t<CPU_TASKS; t++)
+			queueBar(cpuBar, cpu[t], row++);
+	}
+
+	void queueBar(VAO *bar, const TimingSeries& T, int row) {
+		// Straight to clip space, at the near plane so nothing covers it
+		float x = -0.95, y = 0.9 - 0.06*row;
+		float length = min(1.8, T.average()/FRAME_BUDGET_MS);
+		float at = min(1.8, T.p99()/FRAME_BUDGET_MS);
+		Queue.push(LAYER_HUD, bar, glm::translate (glm::vec3(x, y, -0.999)) * glm::scale(glm::vec3(length, 0.04, 1)));
+		Queue.push(LAYER_HUD, mark, glm::translate (glm::vec3(x+at, y, -0.999)) * glm::scale(glm::vec3(0.005, 0.04, 1)));
+	}
+} Profile;
+
+// Prints the timings on exit, if any were taken
+void reportTimings ()
 {
-	VAO * rectangle;
-	GLfloat vertex_buffer_data [] = { x1,y1,0, x2,y2,0 , x3,y3,0, x4,y4,0, x3,y3,0 , x2,y2,0};
-	GLfloat color_buffer_data [] = {  r1,g1,b1, r1,g1,b1, r2,g2,b2,  r2,g2,b2, r2,g2,b2, r1,g1,b1}; // 1 , 2 , 3 , 4 , 3, 2
-	rectangle = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
-	return rectangle;
+	if (Profile.enabled)
+		Profile.report(cout);
 }
 
-void createSevenSeg()
+/**
+   Render snapshots. Everything draw() needs from the world, copied out
+   after a tick so the renderer never reads bodies the physics is moving.
+*/
+struct BodyState {
+	float x, y;
+	float px, py;	// position at the tick before
+	float radius;
+	bool alive;
+};
+
+class Snapshot {
+public:
+	BodyState bird[MAX_BIRD];
+	BodyState enemy[MAX_ENEMY];
+	BodyState wood[MAX_WOOD];
+	int bird_count;
+	int score;
+	int level;	// counts resets, so the view can follow them
+	double time;	// when the last tick was due, in glfwGetTime seconds
+	double physics_ms;	// time spent in advance() so far
+	long advances;	// advance() calls that ticked or took a command so far
+};
+
+void captureBodies (BodyState *out, const Character *C, int n)
 {
-	sevenseg[0]=createRectangle(0.0,0.0,0.0,0.0,0.0,0.0, 0.0f/3,0.0f/3, 0.8f/3,0.0f/3 , 0.1f/3,0.1f/3, 0.7f/3,0.1f/3);
-	sevenseg[1]=createRectangle(0.0,0.0,0.0,0.0,0.0,0.0, 0.0f/3,0.1f/3, 0.1f/3,0.2f/3 , 0.0f/3,.9f/3, 0.1f/3,0.8f/3);
-	sevenseg[2]=createRectangle(0.0,0.0,0.0,0.0,0.0,0.0, 0.0f/3,1.0f/3, 0.1f/3,1.1f/3 , 0.0f/3,1.8f/3, 0.1f/3,1.7f/3);
-	sevenseg[3]=createRectangle(0.0,0.0,0.0,0.0,0.0,0.0, 0.1f/3,1.8f/3, 0.7f/3,1.8f/3 , 0.0f/3,1.9f/3, 0.8f/3,1.9f/3);
-	sevenseg[4]=createRectangle(0.0,0.0,0.0,0.0,0.0,0.0, 0.7f/3,1.1f/3, 0.8f/3,1.0f/3 , 0.7f/3,1.7f/3, 0.8f/3,1.8f/3);
-	sevenseg[5]=createRectangle(0.0,0.0,0.0,0.0,0.0,0.0, 0.7f/3,0.2f/3, 0.8f/3,0.1f/3 , 0.7f/3,0.8f/3, 0.8f/3,0.9f/3);
-	sevenseg[6]=createRectangle(0.0,0.0,0.0,0.0,0.0,0.0, 0.1f/3,0.95f/3, 0.7f/3,0.95f/3 , 0.2f/3,1.0f/3, 0.6f/3,1.0f/3);
-	sevenseg[7]=createRectangle(0.0,0.0,0.0,0.0,0.0,0.0, 0.2f/3,0.9f/3, 0.6f/3,0.9f/3 , 0.1f/3,0.95f/3, 0.7f/3,0.95f/3);
+	for (int i=0; i<n; i++) {
+		out[i].x = C[i].x;
+		out[i].y = C[i].y;
+		out[i].px = C[i].px;
+		out[i].py = C[i].py;
+		out[i].radius = C[i].radius;
+		out[i].alive = C[i].alive;
+	}
+}
 
+// Position of B as drawn alpha of the way from its previous tick to its last
+glm::vec3 renderPos(const BodyState& B, float alpha) {
+	return glm::vec3(B.px + (B.x-B.px)*alpha, B.py + (B.y-B.py)*alpha, 0);
+}
 
-	for(int i=0;i<6;i++)
-		sevensegdecoder[0].push_back(i);
-	sevensegdecoder[1].push_back(4);
-	sevensegdecoder[1].push_back(5);
+/**
+   Lock free triple buffer. The writer fills its back slot and swaps it
+   with the middle one; the reader swaps the middle slot for its front
+   one only when the FRESH bit says it holds something it hasn't seen.
+   Neither side ever waits, and the reader always gets the newest
+   complete snapshot.
+*/
+#define FRESH 4
 
-	sevensegdecoder[2].push_back(3);
-	sevensegdecoder[2].push_back(4);
-	sevensegdecoder[2].push_back(6);
-	sevensegdecoder[2].push_back(7);
-	sevensegdecoder[2].push_back(1);
-	sevensegdecoder[2].push_back(0);
+class TripleBuffer {
+public:
+	Snapshot slots[3];
+	atomic<int> middle;
+	int back, front;
 
-	sevensegdecoder[3].push_back(3);
-	sevensegdecoder[3].push_back(4);
-	sevensegdecoder[3].push_back(6);
-	sevensegdecoder[3].push_back(7);
-	sevensegdecoder[3].push_back(5);
-	sevensegdecoder[3].push_back(0);
+	TripleBuffer() : middle(1), back(2), front(0) {}
 
-	sevensegdecoder[4].push_back(2);
-	sevensegdecoder[4].push_back(6);
-	sevensegdecoder[4].push_back(7);
-	sevensegdecoder[4].push_back(4);
-	sevensegdecoder[4].push_back(5);
+	Snapshot& writeBuffer() {
+		return slots[back];
+	}
 
+	void publish() {
+		back = middle.exchange(back | FRESH, memory_order_acq_rel) & ~FRESH;
+	}
 
-	sevensegdecoder[5].push_back(3);
-	sevensegdecoder[5].push_back(2);
-	sevensegdecoder[5].push_back(6);
-	sevensegdecoder[5].push_back(7);
-	sevensegdecoder[5].push_back(5);
-	sevensegdecoder[5].push_back(0);
+	const Snapshot& read() {
+		if (middle.load(memory_order_relaxed) & FRESH)
+			front = middle.exchange(front, memory_order_acq_rel) & ~FRESH;
+		return slots[front];
+	}
+};
 
+/**
+   Input for the physics thread. The input callbacks are the only
+   producer and the physics thread the only consumer, so the ring needs
+   no lock: each side owns one index and publishes it with a release
+   store. A command sent to a full queue is dropped.
+*/
+#define COMMAND_QUEUE 64
 
-	sevensegdecoder[6].push_back(3);
-	sevensegdecoder[6].push_back(2);
-	sevensegdecoder[6].push_back(6);
-	sevensegdecoder[6].push_back(7);
-	sevensegdecoder[6].push_back(5);
-	sevensegdecoder[6].push_back(1);
-	sevensegdecoder[6].push_back(0);
+enum command_type { CMD_FIRE, CMD_RESET };
 
+struct Command {
+	int type;
+	float angle, power;	// for CMD_FIRE
+};
 
-	sevensegdecoder[7].push_back(3);
-	sevensegdecoder[7].push_back(4);
-	sevensegdecoder[7].push_back(5);
+class CommandQueue {
+public:
+	Command ring[COMMAND_QUEUE];
+	atomic<unsigned> head;	// next to pop, written by the consumer
+	atomic<unsigned> tail;	// next to push, written by the producer
+
+	CommandQueue() : head(0), tail(0) {}
+
+	bool push(const Command& c) {
+		unsigned t = tail.load(memory_order_relaxed);
+		if (t - head.load(memory_order_acquire) == COMMAND_QUEUE)
+			return false;
+		ring[t % COMMAND_QUEUE] = c;
+		tail.store(t+1, memory_order_release);
+		return true;
+	}
 
-	for(int i=0;i<8;i++)
-		sevensegdecoder[8].push_back(i);
+	bool pop(Command& c) {
+		unsigned h = head.load(memory_order_relaxed);
+		if (h == tail.load(memory_order_acquire))
+			return false;
+		c = ring[h % COMMAND_QUEUE];
+		head.store(h+1, memory_order_release);
+		return true;
+	}
+};
 
-	sevensegdecoder[9].push_back(2);
-	sevensegdecoder[9].push_back(3);
-	sevensegdecoder[9].push_back(4);
-	sevensegdecoder[9].push_back(6);
-	sevensegdecoder[9].push_back(7);
-	sevensegdecoder[9].push_back(5);
+/**
+   Physics thread. The game runs on its own thread at tick_rate, so a
+   swap waiting on vsync doesn't hold up physics and a heavy tick
+   doesn't hold up the frame. After each batch of ticks it publishes a
+   Snapshot, and it applies the input's Commands before ticking. With
+   --sync-physics no thread is started and the main loop calls advance()
+   itself every frame, through the same snapshots and commands.
+*/
+class Simulation {
+public:
+	TripleBuffer snapshots;
+	CommandQueue commands;
+	thread worker;
+	atomic<bool> running;
+	int level;
+	double physics_ms;	// totals published in each Snapshot
+	long advances;
+
+	Simulation() : running(false), level(0), physics_ms(0), advances(0) {}
+
+	void start(double rate, int steps, bool threaded) {
+		Clock.start(glfwGetTime(), rate, steps);
+		publish(glfwGetTime());
+		if (!threaded)
+			return;
+		running = true;
+		worker = thread(&Simulation::run, this);
+	}
 
-}
+	void stop() {
+		if (!worker.joinable())
+			return;
+		running = false;
+		worker.join();
+	}
 
-/* Generate VAO, VBOs and return VAO handle - Common Color for all vertices */
-struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat red, const GLfloat green, const GLfloat blue, GLenum fill_mode=GL_FILL)
-{
-	GLfloat* color_buffer_data = new GLfloat [3*numVertices];
-	for (int i=0; i<numVertices; i++) {
-		color_buffer_data [3*i] = red;
-		color_buffer_data [3*i + 1] = green;
-		color_buffer_data [3*i + 2] = blue;
+	void send(int type, float angle=0, float power=0) {
+		Command c;
+		c.type = type;
+		c.angle = angle;
+		c.power = power;
+		commands.push(c);
 	}
 
-	return create3DObject(primitive_mode, numVertices, vertex_buffer_data, color_buffer_data, fill_mode);
-}
+	void restart() {
+		Main.reset();
+		level++;
+	}
 
-/* Render the VBOs handled by VAO */
-void draw3DObject (struct VAO* vao)
-{
-	// Change the Fill Mode for this object
-	glPolygonMode (GL_FRONT_AND_BACK, vao->FillMode);
+	// Applies the queued commands and runs the ticks due at time now
+	void advance(double now) {
+		chrono::steady_clock::time_point began = chrono::steady_clock::now();
+		bool changed = false;
+		Command c;
+		while (commands.pop(c)) {
+			if (c.type == CMD_FIRE)
+				Main.shoot(c.angle, c.power);
+			else if (c.type == CMD_RESET)
+				restart();
+			changed = true;
+		}
+		for (int n=Clock.due(now); n>0; n--) {
+			Main.step();
+			if (!enemies_left)
+				restart();
+			changed = true;
+		}
+		if (changed) {
+			physics_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - began).count();
+			advances++;
+			publish(now);
+		}
+	}
 
-	// Bind the VAO to use
-	glBindVertexArray (vao->VertexArrayID);
+	void publish(double now) {
+		Snapshot& S = snapshots.writeBuffer();
+		captureBodies(S.bird, Bird, MAX_BIRD);
+		captureBodies(S.enemy, Enemies, MAX_ENEMY);
+		captureBodies(S.wood, Wood, MAX_WOOD);
+		S.bird_count = bird_count;
+		S.score = Player1.score;
+		S.level = level;
+		S.time = now - Clock.accumulator;
+		S.physics_ms = physics_ms;
+		S.advances = advances;
+		snapshots.publish();
+	}
 
-	// Enable Vertex Attribute 0 - 3d Vertices
-	glEnableVertexAttribArray(0);
-	// Bind the VBO to use
-	glBindBuffer(GL_ARRAY_BUFFER, vao->VertexBuffer);
+	void run() {
+		while (running.load()) {
+			advance(glfwGetTime());
+			// Sleep until the next tick is due
+			this_thread::sleep_for(chrono::duration<double>(Clock.tick - Clock.accumulator));
+		}
+	}
+} Sim;
 
-	// Enable Vertex Attribute 1 - Color
-	glEnableVertexAttribArray(1);
-	// Bind the VBO to use
-	glBindBuffer(GL_ARRAY_BUFFER, vao->ColorBuffer);
+bool sync_physics = false;	// tick in the main loop instead of on a thread
 
-	// Draw the geometry !
-	glDrawArrays(vao->PrimitiveMode, 0, vao->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
+void stopSimulation ()
+{
+	Sim.stop();
 }
 
+// The player's aim, owned by the input side and sent along with each shot
+struct Aim {
+	float angle, power;
+} Aiming;
+
+int shown_level = 0;	// level of the snapshot last drawn
+
 /**************************
  * Customizable functions *
  **************************/
@@ -544,61 +3355,8 @@ float rectangle_rot_dir = 1;
 bool triangle_rot_status = true;
 bool rectangle_rot_status = true;
 
-void createBird (int index, float x, float y)
-{
-	Bird[index].health = 5;
-	Bird[index].x = x;
-	Bird[index].alive = 1;
-	Bird[index].y = y;
-	Bird[index].radius = 0.2;
-	Bird[index].Vel = glm::vec2(0, 0);
-	Bird[index].fric_const = 0.96;
-	Bird[index].rest_const = 0.7;
-	Bird[index].air_const = 0.999;
-
-	static GLfloat vertex_buffer_data [3*365];
-	static GLfloat color_buffer_data [3*365];
-
-	int k = 0;
-	vertex_buffer_data[0] = 0;
-	color_buffer_data[0] = 0.8;
-	k++;
-	vertex_buffer_data[1] = 0;
-	color_buffer_data[1] = 0;
-	k++;
-	vertex_buffer_data[2] = 0;
-	color_buffer_data[2] = 0;
-	k++;
-
-	for (int i=0; i<=360; ++i)
-	{
-		vertex_buffer_data[k] = cos((i*M_PI)/180)*Bird[index].radius;
-		color_buffer_data[k] = 0.9;
-		k++;
-		vertex_buffer_data[k] = sin((i*M_PI)/180)*Bird[index].radius;
-		color_buffer_data[k] = 0;
-		k++;
-		vertex_buffer_data[k] = 0;
-		color_buffer_data[k] = 0;
-		k++;
-	}
-
-	// create3DObject creates and returns a handle to a VAO that can be used later
-	Bird[index].sprite = create3DObject(GL_TRIANGLE_FAN, 362, vertex_buffer_data, color_buffer_data, GL_FILL);
-}
-
-void fire_bird() {
-	if(bird_count >= 15)
-		return;
-	createBird(bird_count, Cannon.x, Cannon.y);
-	Bird[bird_count].Vel = glm::vec2(
-		Cannon.power * 0.2 * cos((Cannon.angle*M_PI)/180),
-		Cannon.power * 0.2 * sin((Cannon.angle*M_PI)/180)
-		);
-	bird_count++;
-}
-
 float zoom = 4.0, pan = 0.0;
+int viewport_height = 1;
 
 /* Executed when a regular key is pressed/released/held-down */
 /* Prefered for Keyboard events */
@@ -614,9 +3372,13 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
 		case GLFW_KEY_P:
 			triangle_rot_status = !triangle_rot_status;
 			break;
+		case GLFW_KEY_F3:
+			Profile.overlay = !Profile.overlay;
+			Profile.enabled |= Profile.overlay;
+			break;
 		case GLFW_KEY_SPACE:
-			fire_bird();
-			Cannon.power = 0;
+			Sim.send(CMD_FIRE, Aiming.angle, Aiming.power);
+			Aiming.power = 0;
 			break;
 		}
 	}
@@ -650,15 +3412,13 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
 			PowerBar.x = 4.4<PowerBar.x? 4.4:PowerBar.x;
 			break;
 		case GLFW_KEY_SPACE:
-			Cannon.power += 0.1;
-			Cannon.power = Cannon.power<MAX_POWER ? Cannon.power:MAX_POWER;
+			Aiming.power += 0.1;
+			Aiming.power = Aiming.power<MAX_POWER ? Aiming.power:MAX_POWER;
 			break;
 		}
 	}
 }
 
-void resetGame();
-
 /* Executed for character input (like in text boxes) */
 void keyboardChar (GLFWwindow* window, unsigned int key)
 {
@@ -668,23 +3428,23 @@ void keyboardChar (GLFWwindow* window, unsigned int key)
 		quit(window);
 		break;
 	case 'r':
-		resetGame();
+		Sim.send(CMD_RESET);
 		break;
 	case 'a':
-		Cannon.angle += 2;
-		Cannon.angle = Cannon.angle>90? 90:Cannon.angle;
+		Aiming.angle += 2;
+		Aiming.angle = Aiming.angle>90? 90:Aiming.angle;
 		break;
 	case 'b':
-		Cannon.angle -= 2;
-		Cannon.angle = Cannon.angle<-90? -90:Cannon.angle;
+		Aiming.angle -= 2;
+		Aiming.angle = Aiming.angle<-90? -90:Aiming.angle;
 		break;
 	case 'f':
-		Cannon.power += 0.1;
-		Cannon.power = Cannon.power<MAX_POWER ? Cannon.power:MAX_POWER;
+		Aiming.power += 0.1;
+		Aiming.power = Aiming.power<MAX_POWER ? Aiming.power:MAX_POWER;
 		break;
 	case 's':
-		Cannon.power -= 0.1;
-		Cannon.power = Cannon.power>0 ? Cannon.power:0;
+		Aiming.power -= 0.1;
+		Aiming.power = Aiming.power>0 ? Aiming.power:0;
 		break;
 	case 'i':
 		zoom += 0.5;
@@ -709,7 +3469,7 @@ void mouseButton (GLFWwindow* window, int button, int action, int mods)
 	switch (button) {
 	case GLFW_MOUSE_BUTTON_LEFT:
 		if (action == GLFW_RELEASE)
-			fire_bird();
+			Sim.send(CMD_FIRE, Aiming.angle, Aiming.power);
 		break;
 	case GLFW_MOUSE_BUTTON_RIGHT:
 		if (action == GLFW_RELEASE) {
@@ -721,6 +3481,8 @@ void mouseButton (GLFWwindow* window, int button, int action, int mods)
 	}
 }
 
+void resizeBackgroundCache (int width, int height);
+
 /* Executed when window is resized to 'width' and 'height' */
 /* Modify the bounds of the screen here in glm::ortho or Field of View in glm::Perspective */
 void reshapeWindow (GLFWwindow* window, int width, int height)
@@ -734,6 +3496,8 @@ void reshapeWindow (GLFWwindow* window, int width, int height)
 
 	// sets the viewport of openGL renderer
 	glViewport (0, 0, (GLsizei) fbwidth, (GLsizei) fbheight);
+	viewport_height = fbheight;
+	resizeBackgroundCache(fbwidth, fbheight);
 
 	// set the projection matrix as perspective
 	/* glMatrixMode (GL_PROJECTION);
@@ -802,67 +3566,285 @@ void createRectangle ()
 	rectangle = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
 }
 
-void createEnemies ()
+/**
+   Circle level of detail. A fan disc is built at 128 segments and
+   chained through coarser to the same disc at 64, 32 and 16, all made
+   once with the mesh. circleLOD walks down the chain to the coarsest
+   disc whose rim strays less than half a pixel from the true circle at
+   this frame's zoom.
+*/
+#define LOD_MAX_SEGMENTS 128
+#define LOD_MIN_SEGMENTS 16
+
+/* Triangle fan disc, shaded from the centre colour (r1,g1,b1) to the rim colour (r2,g2,b2) */
+VAO * createCircleFan (float radius, float r1,float g1,float b1,float r2,float g2,float b2, int segments=LOD_MAX_SEGMENTS)
 {
-	Enemies[0].x =2;
-	Enemies[0].y =0;
-	Enemies[1].x =8;
-	Enemies[1].y =-2;
-	Enemies[2].x =8.5;
-	Enemies[2].y =-2;
-	Enemies[3].x =9;
-	Enemies[3].y =-2;
-	Enemies[4].x =4;
-	Enemies[4].y =-2.5;
-	Enemies[5].x =8.6;
-	Enemies[5].y =1.3;
-	for (int i=0; i<ENEMY_NUMBER ;i++) {
-		Enemies[i].radius = 0.2;
-		Enemies[i].Vel = glm::vec2(0, 0);
-		Enemies[i].alive = 1;
-		Enemies[i].fric_const = 0.96;
-		Enemies[i].rest_const = 0.7;
-		Enemies[i].air_const = 0.95;
-
-		GLfloat vertex_buffer_data [3*365];
-		GLfloat color_buffer_data [3*365];
-
-		int k = 0;
-		vertex_buffer_data[0] = 0;
-		color_buffer_data[0] = 0;
-		k++;
-		vertex_buffer_data[1] = 0;
-		color_buffer_data[1] = 0.8;
-		k++;
-		vertex_buffer_data[2] = 0;
-		color_buffer_data[2] = 0.4;
-		k++;
-
-		for (int j=0; j<=360; ++j)
-		{
-			vertex_buffer_data[k] = cos((j*M_PI)/180)*Enemies[i].radius;
-			color_buffer_data[k] = 0;
-			k++;
-			vertex_buffer_data[k] = sin((j*M_PI)/180)*Enemies[i].radius;
-			color_buffer_data[k] = 0.5;
-			k++;
-			vertex_buffer_data[k] = 0;
-			color_buffer_data[k] = 0;
-			k++;
-		}
+	vector<GLfloat> vertex_buffer_data;
+	vector<GLfloat> color_buffer_data;
 
-		// create3DObject creates and returns a handle to a VAO that can be used later
-		Enemies[i].sprite = create3DObject(GL_TRIANGLE_FAN, 362, vertex_buffer_data, color_buffer_data, GL_FILL);
+	vertex_buffer_data.push_back(0);
+	vertex_buffer_data.push_back(0);
+	vertex_buffer_data.push_back(0);
+	color_buffer_data.push_back(r1);
+	color_buffer_data.push_back(g1);
+	color_buffer_data.push_back(b1);
+
+	for (int i=0; i<=segments; ++i)
+	{
+		vertex_buffer_data.push_back(cos((2*M_PI*i)/segments)*radius);
+		vertex_buffer_data.push_back(sin((2*M_PI*i)/segments)*radius);
+		vertex_buffer_data.push_back(0);
+		color_buffer_data.push_back(r2);
+		color_buffer_data.push_back(g2);
+		color_buffer_data.push_back(b2);
 	}
+
+	// create3DObject creates and returns a handle to a VAO that can be used later
+	VAO *fan = create3DObject(GL_TRIANGLE_FAN, segments+2, &vertex_buffer_data[0], &color_buffer_data[0], GL_FILL);
+	if (segments > LOD_MIN_SEGMENTS)
+		fan->coarser = createCircleFan(radius, r1, g1, b1, r2, g2, b2, segments/2);
+	return fan;
 }
 
-void createWall ()
+// Coarsest detail level of a circle sprite that still looks round under VP
+VAO * circleLOD (VAO *circle, float radius, const glm::mat4& VP)
 {
-	CWall.x = 0;
-	CWall.y = -2;
-	CWall.size_x = 0.5;
-	CWall.size_y = 1.09;
+	float pixels = radius * fabs(VP[1][1]) * viewport_height/2;
+	while (circle->coarser) {
+		int segments = circle->coarser->NumVertices - 2;
+		if (pixels*(1 - cos(M_PI/segments)) > 0.5)
+			break;
+		circle = circle->coarser;
+	}
+	return circle;
+}
+
+/**
+   Distance field circles. A circle is one 4 vertex quad around it and
+   Sample_GL_circle.frag works out per pixel how far inside the circle
+   the pixel is, shading from centre to rim and fading the rim over one
+   pixel, so the edge stays smooth at any zoom. With sdf_circles off
+   circles are triangle fans instead.
+*/
+bool sdf_circles = true;
+
+Shader CircleShader;
+
+struct CircleVertex {
+	GLfloat x, y, z;
+	GLfloat u, v;	// position in radii from the centre
+	GLubyte r1, g1, b1, a1;	// centre color
+	GLubyte r2, g2, b2, a2;	// rim color
+};
+
+void createCircleShader ()
+{
+	CircleShader.ProgramID = LoadShaders( "Sample_GL_circle.vert", "Sample_GL_circle.frag" );
+	CircleShader.MatrixID = glGetUniformLocation(CircleShader.ProgramID, "MVP");
+	CircleShader.blend = true;
+}
+
+VAO * createCircleQuad (float radius, float r1,float g1,float b1,float r2,float g2,float b2)
+{
+	static const GLfloat corners [] = { -1,-1, 1,-1, -1,1, 1,1 };
+	CircleVertex vertices[4];
+	for (int i=0; i<4; i++) {
+		CircleVertex& c = vertices[i];
+		c.u = corners[2*i];
+		c.v = corners[2*i + 1];
+		c.x = c.u*radius;
+		c.y = c.v*radius;
+		c.z = 0;
+		c.r1 = packColor(r1);
+		c.g1 = packColor(g1);
+		c.b1 = packColor(b1);
+		c.a1 = 255;
+		c.r2 = packColor(r2);
+		c.g2 = packColor(g2);
+		c.b2 = packColor(b2);
+		c.a2 = 255;
+	}
+
+	struct VAO* vao = new struct VAO;
+	vao->PrimitiveMode = GL_TRIANGLE_STRIP;
+	vao->NumVertices = 4;
+	vao->FillMode = GL_FILL;
+	vao->shader = &CircleShader;
+	vao->coarser = NULL;
+
+	glGenVertexArrays(1, &(vao->VertexArrayID));
+	glGenBuffers (1, &(vao->VertexBuffer));
+	glBindVertexArray (vao->VertexArrayID);
+	glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer);
+	glBufferData (GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(CircleVertex), (void*)0);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(CircleVertex), (void*)offsetof(CircleVertex, r1));
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(CircleVertex), (void*)offsetof(CircleVertex, r2));
+	glEnableVertexAttribArray(3);
+	glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(CircleVertex), (void*)offsetof(CircleVertex, u));
+
+	return vao;
+}
+
+VAO * createCircle (float radius, float r1,float g1,float b1,float r2,float g2,float b2)
+{
+	if (sdf_circles)
+		return createCircleQuad(radius, r1, g1, b1, r2, g2, b2);
+	return createCircleFan(radius, r1, g1, b1, r2, g2, b2);
+}
+
+// Planks are brown, the floors and the roof are grey
+glm::vec3 woodColor (int i)
+{
+	if(i<112 || (i>192&&i<282))
+		return glm::vec3(0.6, 0.6, 0.6);
+	return glm::vec3(0.6, 0.3, 0);
+}
+
+// Circle from the cache, built by createCircle on first use
+VAO * sharedCircle (float radius, float r1,float g1,float b1,float r2,float g2,float b2)
+{
+	char key[128];
+	snprintf(key, sizeof(key), "circle %g %g %g %g %g %g %g", radius, r1, g1, b1, r2, g2, b2);
+	return Meshes.acquire(key, [=]() {
+		return createCircle(radius, r1, g1, b1, r2, g2, b2);
+	});
+}
+
+// Wood block from the cache, one mesh per color
+VAO * sharedBlock (glm::vec3 color)
+{
+	char key[128];
+	snprintf(key, sizeof(key), "block %g %g %g", color.r, color.g, color.b);
+	return Meshes.acquire(key, [=]() {
+		static const GLfloat vertex_buffer_data [] = {
+			-0.1,-0.1,0, // vertex 1
+			0.1,-0.1,0, // vertex 2
+			0.1, 0.1,0, // vertex 3
+
+			0.1, 0.1,0, // vertex 3
+			-0.1, 0.1,0, // vertex 4
+			-0.1,-0.1,0  // vertex 1
+		};
+		// create3DObject creates and returns a handle to a VAO that can be used later
+		return create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color.r, color.g, color.b, GL_FILL);
+	});
+}
+
+/* Points every bird slot, enemy and wood block at its shared mesh. The
+   sprites depend only on the slot, so they outlive resetGame */
+void createBodySprites ()
+{
+	for (int i=0; i<MAX_BIRD; i++)
+		Bird[i].sprite = sharedCircle(BIRD_RADIUS, 0.8,0,0, 0.9,0,0);
+	for (int i=0; i<ENEMY_NUMBER; i++)
+		Enemies[i].sprite = sharedCircle(Enemies[i].radius, 0,0.8,0.4, 0,0.5,0);
+	for (int i=0; i<WOOD_NUMBER; i++)
+		Wood[i].sprite = sharedBlock(woodColor(i));
+}
+
+// Drops every body's mesh reference, deleting the meshes with the last one
+void releaseBodySprites ()
+{
+	for (int i=0; i<MAX_BIRD; i++)
+		Meshes.release(Bird[i].sprite);
+	for (int i=0; i<ENEMY_NUMBER; i++)
+		Meshes.release(Enemies[i].sprite);
+	for (int i=0; i<WOOD_NUMBER; i++)
+		Meshes.release(Wood[i].sprite);
+}
+
+/**
+   Instanced wood. The blocks share one quad and a per-instance buffer
+   holds each block's offset and color, so all the wood is one
+   glDrawArraysInstanced however many blocks there are. With
+   instanced_wood off every block is drawn from its own sprite instead.
+*/
+bool instanced_wood = true;
+
+struct Instances {
+	GLuint VertexArrayID;
+	GLuint MeshBuffer;
+	GLuint InstanceBuffer;
+	GLuint ProgramID;
+	GLuint VPID;
+	int NumVertices;
+	vector<GLfloat> data;	// x, y, r, g, b per instance
+} WoodInstances;
+
+void createWoodInstances ()
+{
+	static const GLfloat vertex_buffer_data [] = {
+		-0.1,-0.1,0, // vertex 1
+		0.1,-0.1,0, // vertex 2
+		0.1, 0.1,0, // vertex 3
+
+		0.1, 0.1,0, // vertex 3
+		-0.1, 0.1,0, // vertex 4
+		-0.1,-0.1,0  // vertex 1
+	};
+	Instances& I = WoodInstances;
+	I.NumVertices = 6;
+
+	glGenVertexArrays(1, &(I.VertexArrayID));
+	glGenBuffers (1, &(I.MeshBuffer));
+	glGenBuffers (1, &(I.InstanceBuffer));
+	glBindVertexArray (I.VertexArrayID);
+
+	glBindBuffer (GL_ARRAY_BUFFER, I.MeshBuffer);
+	glBufferData (GL_ARRAY_BUFFER, sizeof(vertex_buffer_data), vertex_buffer_data, GL_STATIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+
+	// Attributes 2 and 3 advance once per instance rather than per vertex
+	glBindBuffer (GL_ARRAY_BUFFER, I.InstanceBuffer);
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 5*sizeof(GLfloat), (void*)0);
+	glVertexAttribDivisor(2, 1);
+	glEnableVertexAttribArray(3);
+	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 5*sizeof(GLfloat), (void*)(2*sizeof(GLfloat)));
+	glVertexAttribDivisor(3, 1);
+
+	I.ProgramID = LoadShaders( "Sample_GL_instanced.vert", "Sample_GL.frag" );
+	I.VPID = glGetUniformLocation(I.ProgramID, "VP");
+}
+
+void drawWoodInstances (const glm::mat4& VP, const Snapshot& S, float alpha)
+{
+	Instances& I = WoodInstances;
+	I.data.clear();
+	int count = 0;
+	for (int i=0; i<WOOD_NUMBER; i++) {
+		glm::vec3 pos = renderPos(S.wood[i], alpha), color = woodColor(i);
+		if (!Visible.sees(pos.x, pos.y, S.wood[i].radius, S.wood[i].radius))
+			continue;
+		count++;
+		I.data.push_back(pos.x);
+		I.data.push_back(pos.y);
+		I.data.push_back(color.r);
+		I.data.push_back(color.g);
+		I.data.push_back(color.b);
+	}
+	if (!count)
+		return;
 
+	State.useProgram(I.ProgramID);
+	glUniformMatrix4fv(I.VPID, 1, GL_FALSE, &VP[0][0]);
+	State.polygonMode(GL_FILL);
+	State.blend(false);
+	State.bindVertexArray(I.VertexArrayID);
+	// Respecifying the whole buffer lets the driver hand out fresh storage
+	// instead of waiting on the frame still reading the old one
+	glBindBuffer (GL_ARRAY_BUFFER, I.InstanceBuffer);
+	glBufferData (GL_ARRAY_BUFFER, I.data.size()*sizeof(GLfloat), &I.data[0], GL_STREAM_DRAW);
+	glDrawArraysInstanced(GL_TRIANGLES, 0, I.NumVertices, count);
+}
+
+void createWallSprite ()
+{
 	// GL3 accepts only Triangles. Quads are not supported
 	static const GLfloat vertex_buffer_data [] = {
 		-0.4,-1,0, // vertex 1
@@ -888,161 +3870,8 @@ void createWall ()
 	CWall.sprite = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
 }
 
-void createFloor ()
-{
-	Floor.x = 0;
-	Floor.y = -3.5;
-	Floor.size_x = 400;
-	Floor.size_y = 0.5;
-
-	// GL3 accepts only Triangles. Quads are not supported
-	static const GLfloat vertex_buffer_data [] = {
-		-400,-40,0, // vertex 1
-		400,-40,0, // vertex 2
-		400, -3,0, // vertex 3
-
-		400, -3,0, // vertex 3
-		-400, -3,0, // vertex 4
-		-400,-40,0  // vertex 1
-	};
-
-	static const GLfloat color_buffer_data [] = {
-		0.417,0.178,0.15, // color 1
-		0.417,0.178,0.15, // color 2
-		0.417,0.178,0.15, // color 3
-
-		0.417,0.178,0.15, // color 3
-		0.417,0.178,0.15, // color 4
-		0.417,0.178,0.15  // color 1
-	};
-
-	// create3DObject creates and returns a handle to a VAO that can be used later
-	Floor.sprite = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
-}
-
-void createWood ()
-{
-	static const GLfloat vertex_buffer_data [] = {
-		-0.1,-0.1,0, // vertex 1
-		0.1,-0.1,0, // vertex 2
-		0.1, 0.1,0, // vertex 3
-
-		0.1, 0.1,0, // vertex 3
-		-0.1, 0.1,0, // vertex 4
-		-0.1,-0.1,0  // vertex 1
-	};
-	{
-		for (int i=0; i<MAX_WOOD ;i++) {
-			if(i<30) {
-				Wood[i].x = 5.5+i*0.2;
-				Wood[i].y = -2.9;
-			}
-            else if(i<60) {
-				Wood[i].x = 5.5+(i-30)*0.2;
-				Wood[i].y = -2.9;
-			}
-			else if(i<86) {
-				Wood[i].x = 5.9+(i-60)*0.2;
-				Wood[i].y = -2.7;
-			}
-            else if(i<112) {
-				Wood[i].x = 5.9+(i-86)*0.2;
-				Wood[i].y = -2.7;
-			}
-
-			// Pillar #1
-			else if(i<125) {
-				Wood[i].x = 6.5;
-				Wood[i].y = -2.5+(i-112)*0.2;
-			}
-			else if(i<138) {
-				Wood[i].x = 6.7;
-				Wood[i].y = -2.5+(i-125)*0.2;
-			}
-			else if(i<151) {
-				Wood[i].x = 9.9;
-				Wood[i].y = -2.5+(i-138)*0.2;
-			}
-
-			// Pillar #2
-			else if(i<164) {
-				Wood[i].x = 10.1;
-				Wood[i].y = -2.5+(i-151)*0.2;
-			}
-			else if(i<177) {
-				Wood[i].x = 10.3;
-				Wood[i].y = -2.5+(i-164)*0.2;
-			}
-			else if(i<190) {
-				Wood[i].x = 6.9;
-				Wood[i].y = -2.5+(i-177)*0.2;
-			}
-
-			// Top
-			else if(i<216) {
-				Wood[i].x = 5.9+(i-190)*0.2;
-				Wood[i].y = 0;
-			}
-            else if(i<242) {
-				Wood[i].x = 5.9+(i-216)*0.2;
-				Wood[i].y = 0;
-			}
-			else if(i<264) {
-				Wood[i].x = 6.3+(i-242)*0.2;
-				Wood[i].y = 0.2;
-			}
-            else if(i<282) {
-				Wood[i].x = 6.7+(i-264)*0.2;
-				Wood[i].y = 0.4;
-			}
-
-			// Tower
-			else if(i<292) {
-				Wood[i].x = 1.7;
-				Wood[i].y = -2.9+(i-282)*0.2;
-			}
-			else if(i<302) {
-				Wood[i].x = 2.3;
-				Wood[i].y = -2.9+(i-292)*0.2;
-			}
-			else if(i<308) {
-				Wood[i].x = 1.5+(i-302)*0.2;
-				Wood[i].y = -1;
-			}
-
-			Wood[i].radius = 0.2;
-			Wood[i].Vel = glm::vec2(0, 0);
-			Wood[i].alive = 1;
-			Wood[i].fric_const = 0.96;
-			Wood[i].rest_const = 0.7;
-			Wood[i].air_const = 0.95;
-
-			GLfloat color_buffer_data [] = {
-				0.6,0.3,0, // color 1
-				0.6,0.3,0, // color 2
-				0.6,0.3,0, // color 3
-
-				0.6,0.3,0, // color 3
-				0.6,0.3,0, // color 4
-				0.6,0.3,0  // color 1
-			};
-
-			if(i<112 || (i>192&&i<282))
-				for(int j=0; j<18; j++)
-					color_buffer_data[j]=0.6f;
-			// create3DObject creates and returns a handle to a VAO that can be used later
-			Wood[i].sprite = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
-		}
-	}
-}
-
-void createCannon()
+void createCannonSprites()
 {
-	Cannon.x = -3.5;
-	Cannon.y = -2.7;
-	Cannon.angle = 0;
-	Cannon.power = 0;
-
 	const GLfloat vertex_buffer_data [] = {
 		0, 0.35,0, // vertex 0
 		-0.35,-0.3,0, // vertex 1
@@ -1077,7 +3906,6 @@ void createCannon()
 
 	Cannon.barrel = create3DObject(GL_TRIANGLES, 6, vertex_barrel_data, color_barrel_data, GL_FILL);
 
-
 }
 
 void createTehPower () {
@@ -1106,54 +3934,85 @@ void createTehPower () {
 	PowerBar.sprite = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
 }
 
+// A run of baked vertices making one shape, and the box around it
+struct BakedPiece {
+	GLint first;
+	GLsizei count;
+	float x1, y1, x2, y2;
+};
+
 class Scenery {
 public:
 	float x,y;
-	VAO *grass, *mountain;
-	VAO *sun, *snow, *cloud;
+	VAO *sun, *cloud;
+	VAO *baked;		// mountains, snow, floor and grass as one mesh
+	float anchor_x, anchor_y;	// cannon position baked was laid out around
+	bool dirty;		// the level changed since the last bake
+	vector<BakedPiece> pieces;
+	vector<GLint> firsts;	// visible runs, for glMultiDrawArrays
+	vector<GLsizei> counts;
 } Scene;
 
+/* Background shapes in model space */
+const GLfloat vertex_grass_data [] = {
+	0, 0, 0, // vertex 3
+	-0.1732*2, 0.4,0, // vertex 4
+	0.1732*2, 0.4,0  // vertex 1
+};
 
-void createScene()
-{
-	GLfloat vertex_grass_data [] = {
-		0, 0, 0, // vertex 3
-		-0.1732*2, 0.4,0, // vertex 4
-		0.1732*2, 0.4,0  // vertex 1
-	};
+const GLfloat color_grass_data [] = {
+	0.25,0.5,0, // color 1
+	0.25,0.5,0, // color 2
+	0.25,0.5,0, // color 3
+};
 
-	GLfloat color_grass_data [] = {
-		0.25,0.5,0, // color 1
-		0.25,0.5,0, // color 2
-		0.25,0.5,0, // color 3
-	};
-	Scene.grass = create3DObject(GL_TRIANGLES, 3, vertex_grass_data, color_grass_data, GL_FILL);
-	GLfloat vertex_mountain_data [] = {
-		0, 0, 0, // vertex 3
-		-1.732*2, -4,0, // vertex 4
-		1.732*2, -4,0  // vertex 1
-	};
+const GLfloat vertex_mountain_data [] = {
+	0, 0, 0, // vertex 3
+	-1.732*2, -4,0, // vertex 4
+	1.732*2, -4,0  // vertex 1
+};
 
-	GLfloat color_mountain_data [] = {
-		0.25,0,0.5, // color 1
-		0.25,0,0.5, // color 2
-		0.25,0,0.5, // color 3
-	};
-	Scene.mountain = create3DObject(GL_TRIANGLES, 3, vertex_mountain_data, color_mountain_data, GL_FILL);
+const GLfloat color_mountain_data [] = {
+	0.25,0,0.5, // color 1
+	0.25,0,0.5, // color 2
+	0.25,0,0.5, // color 3
+};
 
-	GLfloat vertex_snow_data [] = {
-		0, 0, 0, // vertex 3
-		-0.732*2, -0.5,0, // vertex 4
-		0.732*2, -0.5,0  // vertex 1
-	};
+const GLfloat vertex_snow_data [] = {
+	0, 0, 0, // vertex 3
+	-0.732*2, -0.5,0, // vertex 4
+	0.732*2, -0.5,0  // vertex 1
+};
 
-	GLfloat color_snow_data [] = {
-		1,1,1, // color 1
-		1,1,1, // color 2
-		1,1,1, // color 3
-	};
-	Scene.snow = create3DObject(GL_TRIANGLES, 3, vertex_snow_data, color_snow_data, GL_FILL);
+const GLfloat color_snow_data [] = {
+	1,1,1, // color 1
+	1,1,1, // color 2
+	1,1,1, // color 3
+};
+
+// GL3 accepts only Triangles. Quads are not supported
+const GLfloat vertex_floor_data [] = {
+	-400,-40,0, // vertex 1
+	400,-40,0, // vertex 2
+	400, -3,0, // vertex 3
+
+	400, -3,0, // vertex 3
+	-400, -3,0, // vertex 4
+	-400,-40,0  // vertex 1
+};
+
+const GLfloat color_floor_data [] = {
+	0.417,0.178,0.15, // color 1
+	0.417,0.178,0.15, // color 2
+	0.417,0.178,0.15, // color 3
+
+	0.417,0.178,0.15, // color 3
+	0.417,0.178,0.15, // color 4
+	0.417,0.178,0.15  // color 1
+};
 
+void createScene()
+{
 	GLfloat vertex_cloud_data [] = {
 		0, 0, 0, // vertex 3
 		-0.732*2, -0.5,0, // vertex 4
@@ -1167,35 +4026,218 @@ void createScene()
 	};
 	Scene.cloud = create3DObject(GL_TRIANGLES, 3, vertex_cloud_data, color_cloud_data, GL_FILL);
 
-	GLfloat vertex_sun_data [3*365];
-	GLfloat color_sun_data [3*365];
-
-	int k = 0;
-	vertex_sun_data[0] = 0;
-	color_sun_data[0] = 1;
-	k++;
-	vertex_sun_data[1] = 0;
-	color_sun_data[1] = 1;
-	k++;
-	vertex_sun_data[2] = 0;
-	color_sun_data[2] = 0;
-	k++;
-
-	for (int j=0; j<=360; ++j)
-	{
-		vertex_sun_data[k] = cos((j*M_PI)/180)*0.5;
-		color_sun_data[k] = 1;
-		k++;
-		vertex_sun_data[k] = sin((j*M_PI)/180)*0.5;
-		color_sun_data[k] = 0.6;
-		k++;
-		vertex_sun_data[k] = 0;
-		color_sun_data[k] = 0;
-		k++;
+	Scene.sun = createCircle(0.5, 1,1,0, 1,0.6,0);
+	Scene.baked = NULL;
+	Scene.dirty = true;
+}
+
+// Appends the n vertices of a shape moved by (dx, dy) as a new baked piece
+void appendShape (vector<Vertex>& out, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, int n, float dx, float dy)
+{
+	BakedPiece p;
+	p.first = out.size();
+	p.count = n;
+	p.x1 = p.y1 = 1e30;
+	p.x2 = p.y2 = -1e30;
+	for (int i=0; i<n; i++) {
+		Vertex v;
+		v.x = vertex_buffer_data[3*i] + dx;
+		v.y = vertex_buffer_data[3*i + 1] + dy;
+		v.z = vertex_buffer_data[3*i + 2];
+		v.r = packColor(color_buffer_data[3*i]);
+		v.g = packColor(color_buffer_data[3*i + 1]);
+		v.b = packColor(color_buffer_data[3*i + 2]);
+		v.a = 255;
+		out.push_back(v);
+		p.x1 = min(p.x1, v.x);
+		p.x2 = max(p.x2, v.x);
+		p.y1 = min(p.y1, v.y);
+		p.y2 = max(p.y2, v.y);
+	}
+	Scene.pieces.push_back(p);
+}
+
+/**
+   Scenery baker. The mountains, both rows of snow, the floor and the
+   grass are laid out around the cannon and never move by themselves, so
+   they are pre-transformed into one vertex buffer and drawn in one call.
+   The triangles go in in the order the pieces used to be drawn in, which
+   a single draw call keeps. The bake is only redone when the cannon has
+   moved or Scene.dirty is set. Returns whether it rebaked.
+*/
+bool bakeScenery ()
+{
+	if (!Scene.dirty && Scene.anchor_x == Cannon.x && Scene.anchor_y == Cannon.y)
+		return false;
+
+	vector<Vertex> vertices;
+	Scene.pieces.clear();
+	for(int i=-10; i<10; i++)
+		appendShape(vertices, vertex_mountain_data, color_mountain_data, 3, Cannon.x-0.5+5*i, Cannon.y+3);
+	for(int i=-10; i<10; i++)
+		appendShape(vertices, vertex_snow_data, color_snow_data, 3, Cannon.x-0.5+5*i, Cannon.y+3);
+	for(int i=-10; i<10; i++)
+		appendShape(vertices, vertex_snow_data, color_snow_data, 3, Cannon.x-3+5*i, Cannon.y+3.8);
+	appendShape(vertices, vertex_floor_data, color_floor_data, 6, 0, 0);
+	for(int i=-100; i<100; i++)
+		appendShape(vertices, vertex_grass_data, color_grass_data, 3, Cannon.x-0.5+0.4*i, Cannon.y-0.7);
+
+	if (Scene.baked)
+		destroy3DObject(Scene.baked);
+	Scene.baked = create3DObject(GL_TRIANGLES, vertices.size(), &vertices[0], GL_FILL);
+	Scene.anchor_x = Cannon.x;
+	Scene.anchor_y = Cannon.y;
+	Scene.dirty = false;
+	return true;
+}
+
+/* Draws the baked pieces in view, neighbouring pieces merged into one
+   run, with a single glMultiDrawArrays */
+void drawScenery (const glm::mat4& VP)
+{
+	Scene.firsts.clear();
+	Scene.counts.clear();
+	for (size_t k=0; k<Scene.pieces.size(); k++) {
+		const BakedPiece& p = Scene.pieces[k];
+		float cx = (p.x1+p.x2)/2, cy = (p.y1+p.y2)/2;
+		if (!Visible.sees(cx, cy, (p.x2-p.x1)/2, (p.y2-p.y1)/2))
+			continue;
+		if (!Scene.firsts.empty() && Scene.firsts.back() + Scene.counts.back() == p.first)
+			Scene.counts.back() += p.count;
+		else {
+			Scene.firsts.push_back(p.first);
+			Scene.counts.push_back(p.count);
+		}
 	}
+	if (Scene.firsts.empty())
+		return;
 
-	// create3DObject creates and returns a handle to a VAO that can be used later
-	Scene.sun = create3DObject(GL_TRIANGLE_FAN, 362, vertex_sun_data, color_sun_data, GL_FILL);
+	State.useProgram(programID);
+	State.blend(false);
+	State.polygonMode(Scene.baked->FillMode);
+	State.bindVertexArray(Scene.baked->VertexArrayID);
+	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &VP[0][0]);
+	glMultiDrawArrays(GL_TRIANGLES, &Scene.firsts[0], &Scene.counts[0], Scene.firsts.size());
+}
+
+/**
+   Background cache. The sun and the baked scenery only change with the
+   camera, so they are rendered into an offscreen texture once and every
+   frame composites that texture with one full screen quad. The cache is
+   redrawn when VP differs from the one it was drawn with, when
+   reshapeWindow gives it a new size or when the scenery is rebaked. If the
+   framebuffer can't be made the layers are drawn directly as before.
+*/
+bool cached_background = true;
+
+class BackgroundCache {
+public:
+	GLuint FramebufferID;
+	GLuint TextureID;
+	GLuint DepthID;
+	GLuint ProgramID;
+	GLint LayerID;
+	VAO *quad;
+	int width, height;
+	glm::mat4 VP;	// camera the texture was drawn with
+	bool valid;
+} Background;
+
+void createBackgroundCache ()
+{
+	// Sits at the far plane so everything drawn afterwards lands on top
+	static const GLfloat vertex_buffer_data [] = {
+		-1,-1,0.999, // vertex 1
+		1,-1,0.999, // vertex 2
+		1, 1,0.999, // vertex 3
+
+		1, 1,0.999, // vertex 3
+		-1, 1,0.999, // vertex 4
+		-1,-1,0.999  // vertex 1
+	};
+	BackgroundCache& B = Background;
+	B.quad = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, 1, 1, 1, GL_FILL);
+	B.ProgramID = LoadShaders( "Sample_GL_texture.vert", "Sample_GL_texture.frag" );
+	B.LayerID = glGetUniformLocation(B.ProgramID, "layer");
+
+	glGenFramebuffers(1, &(B.FramebufferID));
+	glGenTextures(1, &(B.TextureID));
+	glGenRenderbuffers(1, &(B.DepthID));
+	B.width = B.height = 0;
+	B.valid = false;
+}
+
+// Gives the cache the size of the window's framebuffer
+void resizeBackgroundCache (int width, int height)
+{
+	// The main loop reshapes every frame, only a new size drops the cache.
+	// A new projection is caught by drawBackground comparing VP
+	BackgroundCache& B = Background;
+	if (!cached_background || (width == B.width && height == B.height))
+		return;
+	B.valid = false;
+	B.width = width;
+	B.height = height;
+
+	glBindTexture (GL_TEXTURE_2D, B.TextureID);
+	glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	glBindRenderbuffer (GL_RENDERBUFFER, B.DepthID);
+	glRenderbufferStorage (GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+	glBindFramebuffer (GL_FRAMEBUFFER, B.FramebufferID);
+	glFramebufferTexture2D (GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, B.TextureID, 0);
+	glFramebufferRenderbuffer (GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, B.DepthID);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		cerr << "Background framebuffer incomplete, drawing the background directly" << endl;
+		cached_background = false;
+	}
+	glBindFramebuffer (GL_FRAMEBUFFER, 0);
+}
+
+// Draws the layers the cache holds
+void queueBackground (const glm::mat4& VP)
+{
+	if (Visible.sees(Cannon.x, Cannon.y+5, 0.5, 0.5)) {
+		glm::mat4 MVP = VP * glm::translate (glm::vec3(Cannon.x, Cannon.y+5, 0));
+		Queue.push(LAYER_SUN, circleLOD(Scene.sun, 0.5, VP), MVP);
+	}
+
+	// Mountains, snow, floor and grass, over the sun
+	Queue.flush();
+	drawScenery(VP);
+}
+
+void drawBackground (const glm::mat4& VP)
+{
+	BackgroundCache& B = Background;
+	if (bakeScenery())
+		B.valid = false;
+
+	if (!cached_background) {
+		queueBackground(VP);
+		return;
+	}
+
+	if (!B.valid || VP != B.VP) {
+		glBindFramebuffer (GL_FRAMEBUFFER, B.FramebufferID);
+		glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		queueBackground(VP);
+		glBindFramebuffer (GL_FRAMEBUFFER, 0);
+		B.VP = VP;
+		B.valid = true;
+	}
+
+	State.useProgram(B.ProgramID);
+	State.blend(false);
+	glActiveTexture (GL_TEXTURE0);
+	glBindTexture (GL_TEXTURE_2D, B.TextureID);
+	glUniform1i(B.LayerID, 0);
+	draw3DObject(B.quad);
 }
 
 float camera_rotation_angle = 90;
@@ -1211,7 +4253,8 @@ void draw ()
 
 	// use the loaded shader program
 	// Don't change unless you know what you are doing
-	glUseProgram (programID);
+	State.reset();
+	State.useProgram(programID);
 
 	// Eye - Location of camera. Don't change unless you are sure!!
 	glm::vec3 eye ( 5*cos(camera_rotation_angle*M_PI/180.0f), 0, 5*sin(camera_rotation_angle*M_PI/180.0f) );
@@ -1266,86 +4309,80 @@ void draw ()
 
 	//####################################################################################################
 
-	MVP = VP * glm::translate (glm::vec3(Cannon.x, Cannon.y+5, 0));
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-	draw3DObject(Scene.sun);
-
-	for(int i=-10; i<10; i++) {
-		MVP = VP * glm::translate (glm::vec3(Cannon.x-0.5+5*i, Cannon.y+3, 0));
-		glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-		draw3DObject(Scene.mountain);
-	}
-
-	for(int i=-10; i<10; i++) {
-		MVP = VP * glm::translate (glm::vec3(Cannon.x-0.5+5*i, Cannon.y+3, 0));
-		glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-		draw3DObject(Scene.snow);
-	}
-
-	for(int i=-10; i<10; i++) {
-		MVP = VP * glm::translate (glm::vec3(Cannon.x-3+5*i, Cannon.y+3.8, 0));
-		glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-		draw3DObject(Scene.snow);
-	}
-
-	MVP = VP;
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-	draw3DObject(Floor.sprite);
-
-	for(int i=-100; i<100; i++) {
-		MVP = VP * glm::translate (glm::vec3(Cannon.x-0.5+0.4*i, Cannon.y-0.7, 0));
-		glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-		draw3DObject(Scene.grass);
+	// Newest state the physics has published
+	const Snapshot& S = Sim.snapshots.read();
+	// The main loop times advance() itself when it calls it
+	if (!sync_physics)
+		Profile.addPhysics(S.physics_ms, S.advances);
+	float alpha = clamp((glfwGetTime() - S.time)/Clock.tick, 0, 1);
+
+	// A new level puts the camera and the aim back
+	if (S.level != shown_level) {
+		resetView();
+		Aiming.angle = Aiming.power = 0;
+		shown_level = S.level;
 	}
 
+	Visible = viewBox(VP);
+	Profile.beginPass(PASS_BACKGROUND);
+	drawBackground(VP);
+	Profile.endPass(PASS_BACKGROUND);
+	Profile.beginPass(PASS_WORLD);
 
 	MVP = VP * glm::translate (glm::vec3(CWall.x, CWall.y, 0));
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-	draw3DObject(CWall.sprite);
+	Queue.push(LAYER_WALL, CWall.sprite, MVP);
 
 	MVP = VP * glm::translate (glm::vec3(Cannon.x, Cannon.y, 0));
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-	// draw3DObject draws the VAO given to it using current MVP matrix
-	draw3DObject(Cannon.base);
+	Queue.push(LAYER_CANNON, Cannon.base, MVP);
 
-	for (int j=0; j<bird_count; j++) {
-		MVP = VP * glm::translate (glm::vec3(Bird[j].x, Bird[j].y, 0));
-		glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-		// draw3DObject draws the VAO given to it using current MVP matrix
-		draw3DObject(Bird[j].sprite);
+	for (int j=0; j<S.bird_count; j++) {
+		glm::vec3 pos = renderPos(S.bird[j], alpha);
+		if (!Visible.sees(pos.x, pos.y, S.bird[j].radius, S.bird[j].radius))
+			continue;
+		MVP = VP * glm::translate (pos);
+		Queue.push(LAYER_BIRDS, circleLOD(Bird[j].sprite, S.bird[j].radius, VP), MVP);
 	}
 
 	Matrices.model = glm::mat4(1.0f);
 	glm::mat4 translateBarrel = glm::translate (glm::vec3(Cannon.x, Cannon.y, 0));
-	glm::mat4 rotateBarrel = glm::rotate((float)(Cannon.angle*M_PI/180.0f), glm::vec3(0,0,1));
+	glm::mat4 rotateBarrel = glm::rotate((float)(Aiming.angle*M_PI/180.0f), glm::vec3(0,0,1));
 	Matrices.model *= translateBarrel * rotateBarrel;
 	MVP = VP * Matrices.model;
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-	// draw3DObject draws the VAO given to it using current MVP matrix
-	draw3DObject(Cannon.barrel);
+	Queue.push(LAYER_BARREL, Cannon.barrel, MVP);
 
-	MVP = VP * glm::translate (glm::vec3(PowerBar.x, PowerBar.y, 0)) * glm::scale(glm::vec3(2*Cannon.power, 1.0f, 1.0f));
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-	// draw3DObject draws the VAO given to it using current MVP matrix
-	draw3DObject(PowerBar.sprite);
+	MVP = VP * glm::translate (glm::vec3(PowerBar.x, PowerBar.y, 0)) * glm::scale(glm::vec3(2*Aiming.power, 1.0f, 1.0f));
+	Queue.push(LAYER_POWER, PowerBar.sprite, MVP);
 
 	for(int i=0; i<ENEMY_NUMBER; i++) {
-		if (!Enemies[i].alive)
+		const BodyState& E = S.enemy[i];
+		glm::vec3 pos = renderPos(E, alpha);
+		if (!E.alive || !Visible.sees(pos.x, pos.y, E.radius, E.radius))
 			continue;
-		MVP = VP * glm::translate (glm::vec3(Enemies[i].x, Enemies[i].y, 0));
-		glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-		draw3DObject(Enemies[i].sprite);
+		MVP = VP * glm::translate (pos);
+		Queue.push(LAYER_ENEMIES, circleLOD(Enemies[i].sprite, E.radius, VP), MVP);
 	}
 
-	for(int i=0; i<WOOD_NUMBER; i++) {
-		MVP = VP * glm::translate (glm::vec3(Wood[i].x, Wood[i].y, 0));
-		glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-		draw3DObject(Wood[i].sprite);
+	if (instanced_wood) {
+		// Everything queued so far lies under the wood
+		Queue.flush();
+		drawWoodInstances(VP, S, alpha);
 	}
+	else
+		for(int i=0; i<WOOD_NUMBER; i++) {
+			glm::vec3 pos = renderPos(S.wood[i], alpha);
+			if (!Visible.sees(pos.x, pos.y, S.wood[i].radius, S.wood[i].radius))
+				continue;
+			MVP = VP * glm::translate (pos);
+			Queue.push(LAYER_WOOD, Wood[i].sprite, MVP);
+		}
+	Queue.flush();
+	Profile.endPass(PASS_WORLD);
 
 	//####################################################################################################
 
-	int temp=Player1.score;
+	Profile.beginPass(PASS_HUD);
+
+	int temp=S.score;
 	float scorex=0.0f;
 	//Creates the seven segment display for score
 	while(1)
@@ -1356,8 +4393,7 @@ void draw ()
 			glm::mat4 pscore = glm::translate (glm::vec3(10.5f+scorex,2.0f, 0.0f));
 			Matrices.model*= pscore;
 			MVP = VP * Matrices.model;
-			glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-			draw3DObject(sevenseg[sevensegdecoder[temp%10][i]]);
+			Queue.push(LAYER_HUD, sevenseg[sevensegdecoder[temp%10][i]], MVP);
 		}
 		temp/=10;
 		if(!temp)
@@ -1365,7 +4401,7 @@ void draw ()
 		scorex-=1;
 	}
 
-	temp=15-bird_count;
+	temp=MAX_SHOTS-S.bird_count;
 	scorex=0.0f;
 	//Creates the seven segment display for score
 	while(1)
@@ -1376,8 +4412,7 @@ void draw ()
 			glm::mat4 pscore = glm::translate (glm::vec3(scorex-1,-1.0f, 0.0f));
 			Matrices.model*= pscore;
 			MVP = VP * Matrices.model;
-			glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-			draw3DObject(sevenseg[sevensegdecoder[temp%10][i]]);
+			Queue.push(LAYER_HUD, sevenseg[sevensegdecoder[temp%10][i]], MVP);
 		}
 		temp/=10;
 		if(!temp)
@@ -1385,6 +4420,10 @@ void draw ()
 		scorex-=1;
 	}
 
+	Profile.queueOverlay();
+	Queue.flush();
+	Profile.endPass(PASS_HUD);
+
 	// Increment angles
 	float increments = 1;
 
@@ -1462,12 +4501,11 @@ void initGL (GLFWwindow* window, int width, int height)
 	// Create the models
 	createTriangle (); // Generate the VAO, VBOs, vertices data & copy into the array buffer
 	createRectangle ();
-	createFloor ();
-	createWall ();
-	createCannon ();
+	createWallSprite ();
+	createCannonSprites ();
 	createTehPower ();
-	createEnemies();
-	createWood ();
+	createCircleShader ();
+	createBodySprites ();
 	createScene ();
 	createSevenSeg();
 
@@ -1475,6 +4513,9 @@ void initGL (GLFWwindow* window, int width, int height)
 	programID = LoadShaders( "Sample_GL.vert", "Sample_GL.frag" );
 	// Get a handle for our "MVP" uniform
 	Matrices.MatrixID = glGetUniformLocation(programID, "MVP");
+	createWoodInstances ();
+	createBackgroundCache ();
+	Profile.create ();
 	
 	reshapeWindow (window, width, height);
 
@@ -1485,6 +4526,9 @@ void initGL (GLFWwindow* window, int width, int height)
 	glEnable (GL_DEPTH_TEST);
 	glDepthFunc (GL_LEQUAL);
 
+	// Blending is switched on per draw, for shaders writing coverage to alpha
+	glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
 	cout << "VENDOR: " << glGetString(GL_VENDOR) << endl;
 	cout << "RENDERER: " << glGetString(GL_RENDERER) << endl;
 	cout << "VERSION: " << glGetString(GL_VERSION) << endl;
@@ -1504,64 +4548,141 @@ void cursor_position_callback(GLFWwindow* window, double xpos, double ypos)
 	double angle = atan2(ypos, xpos);
 	double distance = sqrt(xpos*xpos+ypos*ypos)/2;
 	distance = min(MAX_POWER, distance/2);
-	Cannon.power = distance;
+	Aiming.power = distance;
 	angle = (angle*180)/M_PI;
 	angle = max(min(90.0, angle), -90.0);
-	Cannon.angle = angle;
-}
-
-void resetGame()
-{
-	Game.x = 3.6;
-	Game.y = 0;
-	Game.z = 3;
-	enemies_left = ENEMY_NUMBER;
-	Player1.lives = 5;
-	Player1.score = 0;
-	Player1.game_over = 0;
-	bird_count = 0;
-	createEnemies();
-	createWood();
+	Aiming.angle = angle;
 }
+#endif
 
 int main (int argc, char** argv)
 {
+#ifndef HEADLESS
+	double tick_rate = 60;
+	int max_steps = 5;
+#endif
+	int threads = max(1u, thread::hardware_concurrency());
+	bool headless = false;
+	int batch = 0;
+	bool solve = false;
+	bool check = false;
+	int solve_grid = 24;
+	int budget = 1000;
+	int ticks = 10000;
+	int shot_ticks = 300;
+	vector<glm::vec2> shots;
+
+	for (int i=1; i<argc; i++) {
+		if (!strcmp(argv[i], "--threads") && i+1 < argc)
+			threads = max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "--headless"))
+			headless = true;
+		else if (!strcmp(argv[i], "--ticks") && i+1 < argc)
+			ticks = max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "--shot") && i+2 < argc) {
+			float angle = atof(argv[++i]);
+			float power = atof(argv[++i]);
+			shots.push_back(glm::vec2(angle, power));
+		}
+		else if (!strcmp(argv[i], "--shot-ticks") && i+1 < argc)
+			shot_ticks = max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "--batch") && i+1 < argc)
+			batch = max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "--solve"))
+			solve = true;
+		else if (!strcmp(argv[i], "--check"))
+			check = true;
+		else if (!strcmp(argv[i], "--solve-grid") && i+1 < argc)
+			solve_grid = max(2, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "--budget") && i+1 < argc)
+			budget = max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "--no-substeps"))
+			adaptive_substeps = false;
+		else if (!strcmp(argv[i], "--broadphase") && i+1 < argc) {
+			i++;
+			broadphase = !strcmp(argv[i], "sap") ? BROAD_SAP : BROAD_GRID;
+		}
+#ifndef HEADLESS
+		else if (!strcmp(argv[i], "--tick-rate") && i+1 < argc)
+			tick_rate = max(1.0, atof(argv[++i]));
+		else if (!strcmp(argv[i], "--max-steps") && i+1 < argc)
+			max_steps = max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "--no-instancing"))
+			instanced_wood = false;
+		else if (!strcmp(argv[i], "--no-background-cache"))
+			cached_background = false;
+		else if (!strcmp(argv[i], "--no-sdf-circles"))
+			sdf_circles = false;
+		else if (!strcmp(argv[i], "--no-culling"))
+			culling = false;
+		else if (!strcmp(argv[i], "--profile"))
+			Profile.enabled = true;
+		else if (!strcmp(argv[i], "--sync-physics"))
+			sync_physics = true;
+#endif
+	}
+#ifdef HEADLESS
+	headless = true;
+#endif
+
+	selectKernels();
+	cout << "SIMD: " << Simd.name << endl;
+	Pool.start(threads);
+	cout << "THREADS: " << Pool.threads << endl;
+	cout << "BROADPHASE: " << (broadphase == BROAD_SAP ? "sap" : "grid") << endl;
+
+	resetGame();
+
+	if (check)
+		return runCheck();
+	if (solve)
+		return runSolve(solve_grid, budget);
+	if (batch)
+		return runBatch(batch, ticks, shot_ticks);
+	if (headless)
+		return runHeadless(ticks, shots, shot_ticks);
+
+#ifndef HEADLESS
 	int width = 1400;
 	int height = 800;
 
 	GLFWwindow* window = initGLFW(width, height);
 
 	initGL (window, width, height);
-	resetGame();
-	double last_update_time = glfwGetTime(), current_time;
+	glfwSetCursorPosCallback(window, cursor_position_callback);
+	// Simulation runs at tick_rate whatever the refresh rate is
+	Sim.start(tick_rate, max_steps, !sync_physics);
 
 	/* Draw in loop */
 	while (!glfwWindowShouldClose(window)) {
+		if (sync_physics) {
+			Profile.start(TASK_PHYSICS);
+			Sim.advance(glfwGetTime());
+			Profile.stop(TASK_PHYSICS);
+		}
+
 		reshapeWindow (window, width, height);
 
 		// OpenGL Draw commands
+		Profile.start(TASK_DRAW);
 		draw();
+		Profile.stop(TASK_DRAW);
 		// Swap Frame Buffer in double buffering
+		Profile.start(TASK_SWAP);
 		glfwSwapBuffers(window);
+		Profile.stop(TASK_SWAP);
 
 		// Poll for Keyboard and mouse events
+		Profile.start(TASK_POLL);
 		glfwPollEvents();
-
-		gravity();
-		glfwSetCursorPosCallback(window, cursor_position_callback);
-
-		if(!enemies_left)
-			resetGame();
-
-		// The function signature for cursor position callbacks. More...
-		// Control based on time (Time based transformation like 5 degrees rotation every 0.5s)
-		current_time = glfwGetTime(); // Time in seconds
-		if ((current_time - last_update_time) >= 0.1) {
-
-			last_update_time = current_time;
-		}
+		Profile.stop(TASK_POLL);
+		Profile.endFrame();
 	}
 
+	stopSimulation();
+	reportTimings();
+	releaseBodySprites();
 	glfwTerminate();
+#endif
 	exit(EXIT_SUCCESS);
 }